@@ -24,16 +24,18 @@ bool EntityView::DrawSpheres(const std::shared_ptr<Scene>& scene) {
     bool changed = false;
     scene->VisitSphere([&](Sphere& sphere, Material& material) {
         ImGui::PushID(&sphere);
-        changed |= ImGui::DragFloat3("Position", &sphere.position.x, 0.01f);
-        changed |= ImGui::DragFloat("Radius", &sphere.radius, 0.01f);
+        bool modified = false;
+        modified |= ImGui::DragFloat3("Position", &sphere.position.x, 0.01f);
+        modified |= ImGui::DragFloat("Radius", &sphere.radius, 0.01f);
 
-        changed |= ImGui::ColorEdit3("Color", &material.color.x, 0.01f);
-        changed |= ImGui::SliderFloat("Metalness", &material.metalness, 0.0f, 1.0f);
-        changed |= ImGui::ColorEdit4("Emission Color", &material.emission_color.x, 0.01f);
+        modified |= ImGui::ColorEdit3("Color", &material.color.x, 0.01f);
+        modified |= ImGui::SliderFloat("Metalness", &material.metalness, 0.0f, 1.0f);
+        modified |= ImGui::ColorEdit4("Emission Color", &material.emission_color.x, 0.01f);
 
         ImGui::PopID();
         ImGui::Separator();
-        return changed;
+        changed |= modified;
+        return modified;
     });
 
     return changed;
@@ -43,17 +45,19 @@ bool EntityView::DrawPlanes(const std::shared_ptr<Scene>& scene) {
     bool changed = false;
     scene->VisitPlane([&](Plane& plane, Material& material) {
         ImGui::PushID(&plane);
-        changed |= ImGui::DragFloat3("Position", &plane.position.x, 0.01f);
-        changed |= ImGui::DragFloat3("Normal", &plane.normal.x, 0.01f);
+        bool modified = false;
+        modified |= ImGui::DragFloat3("Position", &plane.position.x, 0.01f);
+        modified |= ImGui::DragFloat3("Normal", &plane.normal.x, 0.01f);
 
-        changed |= ImGui::ColorEdit3("Color", &material.color.x, 0.01f);
-        changed |= ImGui::SliderFloat("Metalness", &material.metalness, 0.0f, 1.0f);
-        changed |= ImGui::ColorEdit4("Emission Color", &material.emission_color.x, 0.01f);
+        modified |= ImGui::ColorEdit3("Color", &material.color.x, 0.01f);
+        modified |= ImGui::SliderFloat("Metalness", &material.metalness, 0.0f, 1.0f);
+        modified |= ImGui::ColorEdit4("Emission Color", &material.emission_color.x, 0.01f);
 
         ImGui::PopID();
         ImGui::Separator();
 
-        return changed;
+        changed |= modified;
+        return modified;
     });
 
     return changed;
@@ -64,29 +68,31 @@ bool EntityView::DrawMeshes(const std::shared_ptr<Scene>& scene) {
     bool changed = false;
     scene->VisitModel([&](Model& model, Material& material) {
         ImGui::PushID(&model);
+        bool modified = false;
 
         auto& modelMatrix = model.GetModelMatrix();
         glm::vec3 translation, rotation, scale;
         decompose(modelMatrix, scale, rotation, translation);
 
-        changed |= ImGui::DragFloat3("Translation", &translation.x, 0.01f);
-        changed |= ImGui::SliderFloat3("Rotation", &rotation.x, 0, 180);
-        changed |= ImGui::DragFloat3("Scale", &scale.x, 0.01f);
+        modified |= ImGui::DragFloat3("Translation", &translation.x, 0.01f);
+        modified |= ImGui::SliderFloat3("Rotation", &rotation.x, 0, 180);
+        modified |= ImGui::DragFloat3("Scale", &scale.x, 0.01f);
 
-        if (changed) {
+        if (modified) {
             model.SetModelMatrix(glm::translate(glm::mat4(1.0f), translation) *
                           glm::toMat4(glm::quat{ glm::radians(rotation) }) *
                           glm::scale(glm::mat4(1.0f), scale));
         }
 
-        changed |= ImGui::ColorEdit3("Color", &material.color.x, 0.01f);
-        changed |= ImGui::SliderFloat("Metalness", &material.metalness, 0.0f, 1.0f);
-        changed |= ImGui::ColorEdit4("Emission Color", &material.emission_color.x, 0.01f);
+        modified |= ImGui::ColorEdit3("Color", &material.color.x, 0.01f);
+        modified |= ImGui::SliderFloat("Metalness", &material.metalness, 0.0f, 1.0f);
+        modified |= ImGui::ColorEdit4("Emission Color", &material.emission_color.x, 0.01f);
 
         ImGui::PopID();
         ImGui::Separator();
 
-        return changed;
+        changed |= modified;
+        return modified;
     });
 
     return changed;
@@ -1,12 +1,13 @@
 #include "RayTracerApp.h"
 
+#include <bit>
+
 #include <glm/gtc/matrix_transform.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
 
 #include "App/Components.h"
 
-static constexpr uint32_t sMaxBvhDepth = 16;
 static constexpr glm::vec3 up = glm::vec3(0, 1, 0); 
 
 RayTracerApp::RayTracerApp()
@@ -15,18 +16,24 @@ RayTracerApp::RayTracerApp()
     mRandomGenerator = std::mt19937(rd());
     mRandomDistribution = std::uniform_int_distribution<uint32_t>();
     
+    mShaderDefines = Scene::GetShaderDefines(BvhBuildSettings{});
     mShader = std::shared_ptr<Shader>(
         Shader::Create(mVulkanManager, "assets/shaders/RayTracer.comp",
-                       ShaderStage::Compute, mSurface->ImageCount()));
-    mPipeline = std::make_shared<ComputePipeline>(mVulkanManager, mShader);
+                       ShaderStage::Compute, mSurface->ImageCount(),
+                       mShaderDefines));
     mCamera = std::make_shared<UniformBuffer<Camera>>(mVulkanManager);
     mSceneDataBuffer = std::make_shared<UniformBuffer<SceneData>>(mVulkanManager);
     mScene = std::make_shared<Scene>(mVulkanManager, mShader, this);
+    CreatePipeline();
 }
 
 RayTracerApp::~RayTracerApp() = default;
 
 void RayTracerApp::OnStart() {
+    // Both files are imported at once while the scene is set up.
+    auto dragonMesh = MeshCache::Global().GetAsync("assets/models/Dragon_80K.obj");
+    auto bunnyMesh = MeshCache::Global().GetAsync("assets/models/bunny.obj");
+
     Material meshMaterial;
     meshMaterial.color = { 1, .64, .22 };
     meshMaterial.emission_color = { 0, 0, 0, 0};
@@ -40,7 +47,8 @@ void RayTracerApp::OnStart() {
                             glm::toMat4(glm::quat{ glm::radians(rotation) }) *
                             glm::scale(glm::mat4(1.0f), scale);
     
-    mScene->AddModel(Model("assets/models/Dragon_80K.obj", meshMaterial, modelMatrix));
+    std::vector<Model> models;
+    models.emplace_back(dragonMesh.get(), meshMaterial, modelMatrix);
 
     translation = glm::vec3(-.5, 0, 0);
     rotation = glm::vec3(90, 0, 0);
@@ -50,7 +58,8 @@ void RayTracerApp::OnStart() {
                   glm::toMat4(glm::quat{ glm::radians(rotation) }) *
                   glm::scale(glm::mat4(1.0f), scale);
 
-    mScene->AddModel(Model("assets/models/bunny.obj", meshMaterial, modelMatrix));
+    models.emplace_back(bunnyMesh.get(), meshMaterial, modelMatrix);
+    mScene->AddModels(std::move(models));
 
     BuildScene();
 }
@@ -61,17 +70,7 @@ void RayTracerApp::OnUpdate(float dt) {
     mSceneData.numFrames++;
 
     if (mWindow.IsKeyPressed(GLFW_KEY_R)) {
-        mVulkanManager->WaitIdle();
-
-        auto* shader =
-            Shader::Create(mVulkanManager, "assets/shaders/RayTracer.comp",
-                ShaderStage::Compute, mSurface->ImageCount());
-        if (shader) {
-            mShader = std::shared_ptr<Shader>(shader);
-        }
-
-        mPipeline = std::make_shared<ComputePipeline>(mVulkanManager, mShader);
-        mSceneData.numFrames = 0;
+        ReloadShader();
     }
 
     bool moved = false;
@@ -111,6 +110,36 @@ void RayTracerApp::OnUpdate(float dt) {
 
 void RayTracerApp::OnRender(float dt,
                             std::shared_ptr<CommandBuffer> commandBuffer) {
+    // The accumulated frames were traced against the scene the rebuild
+    // replaced, which would linger as a ghost until they average out.
+    if (mScene->Update(commandBuffer)) {
+        mSceneData.numFrames = 0;
+        mSceneDataBuffer->UpdateData(mSceneData);
+    }
+
+    // The shader follows the layout of the buffers being rendered, which
+    // changes when a rebuild with new settings was swapped in. A rebuild can
+    // also deepen the trees past what the pipeline was specialized for. The
+    // command buffer has not been submitted yet so waiting is safe.
+    auto defines = Scene::GetShaderDefines(mScene->GetActiveBvhSettings());
+    if (defines != mShaderDefines) {
+        // A failed compile goes back to the settings the current shader was
+        // built for, and is not retried every frame while that rebuild runs.
+        if (defines != mFailedShaderDefines && !ReloadShader()) {
+            LOG_WARNING("Shader failed to compile with the new BVH settings, "
+                        "reverting them");
+            mFailedShaderDefines = defines;
+            mScene->SetBvhSettings(mShaderSettings);
+        }
+        // Nothing is traced until the buffers match the shader again.
+        if (defines != mShaderDefines) {
+            return;
+        }
+    } else if (mScene->GetStackSizes() != mPipelineStackSizes) {
+        mVulkanManager->WaitIdle();
+        CreatePipeline();
+    }
+
     mShader->BindImage(*mRendererImage, "window",
         commandBuffer->CurrentBufferIndex());
     
@@ -183,10 +212,131 @@ void RayTracerApp::RenderSettings() {
             }
             ImGui::TreePop();
         }
+
+        if (ImGui::TreeNode("Mesh cache")) {
+            MeshCache::Stats stats = MeshCache::Global().GetStats();
+            ImGui::Text("%zu meshes, %.1f of %.1f MiB", stats.MeshCount,
+                        stats.Bytes / (1024.0 * 1024.0), stats.BudgetBytes / (1024.0 * 1024.0));
+            ImGui::Text("%llu hits, %llu misses, %llu evictions",
+                        static_cast<unsigned long long>(stats.Hits),
+                        static_cast<unsigned long long>(stats.Misses),
+                        static_cast<unsigned long long>(stats.Evictions));
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("GPU memory")) {
+            MemoryAllocator::Stats stats = mVulkanManager->Allocator().GetStats();
+            ImGui::Text("%u allocations, %u blocks, %u dedicated", stats.AllocationCount,
+                        stats.BlockCount, stats.DedicatedCount);
+            ImGui::Text("%.1f of %.1f MiB in use", stats.UsedBytes / (1024.0 * 1024.0),
+                        stats.ReservedBytes / (1024.0 * 1024.0));
+            if (ImGui::Button("Defragment")) {
+                mScene->Defragment();
+            }
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("BVH")) {
+            BvhBuildSettings bvhSettings = mScene->GetBvhSettings();
+            bool bvhChanged = false;
+
+            const char* splitMethods[] = { "Midpoint", "Binned SAH", "LBVH", "SBVH" };
+            int splitMethod = static_cast<int>(bvhSettings.SplitMethod);
+            if (ImGui::Combo("Split method", &splitMethod, splitMethods, IM_ARRAYSIZE(splitMethods))) {
+                bvhSettings.SplitMethod = static_cast<BvhSplitMethod>(splitMethod);
+                bvhChanged = true;
+            }
+
+            int binCount = static_cast<int>(bvhSettings.BinCount);
+            if (ImGui::SliderInt("SAH bins", &binCount, 2, 64)) {
+                bvhSettings.BinCount = static_cast<uint32_t>(binCount);
+                bvhChanged = true;
+            }
+
+            if (bvhSettings.SplitMethod == BvhSplitMethod::Sbvh) {
+                bvhChanged |= ImGui::SliderFloat("Duplication budget", &bvhSettings.SpatialSplitBudget, 0.0f, 1.0f);
+            }
+
+            bvhChanged |= ImGui::Checkbox("Treelet optimization", &bvhSettings.OptimizeTreelets);
+
+            const char* nodeWidths[] = { "2", "4", "8" };
+            int nodeWidth = std::countr_zero(bvhSettings.NodeWidth) - 1;
+            if (ImGui::Combo("Node width", &nodeWidth, nodeWidths, IM_ARRAYSIZE(nodeWidths))) {
+                bvhSettings.NodeWidth = 2u << nodeWidth;
+                bvhChanged = true;
+            }
+
+            const char* nodePrecisions[] = { "32-bit float", "16-bit", "8-bit" };
+            int nodePrecision = bvhSettings.NodeQuantizationBits == 0 ? 0 :
+                bvhSettings.NodeQuantizationBits == 16 ? 1 : 2;
+            if (ImGui::Combo("Node precision", &nodePrecision, nodePrecisions, IM_ARRAYSIZE(nodePrecisions))) {
+                const uint32_t quantizationBits[] = { 0, 16, 8 };
+                bvhSettings.NodeQuantizationBits = quantizationBits[nodePrecision];
+                bvhChanged = true;
+            }
+
+            const char* triangleFormats[] = { "Vertices", "Vertex and edges", "Woop", "Indexed" };
+            int triangleFormat = static_cast<int>(bvhSettings.TriangleEncoding);
+            if (ImGui::Combo("Triangle format", &triangleFormat, triangleFormats, IM_ARRAYSIZE(triangleFormats))) {
+                bvhSettings.TriangleEncoding = static_cast<TriangleFormat>(triangleFormat);
+                bvhChanged = true;
+            }
+
+            bvhChanged |= ImGui::Checkbox("Quantized vertices", &bvhSettings.QuantizeVertices);
+
+            const char* nodeOrders[] = { "Build", "Depth first", "Van Emde Boas" };
+            int nodeOrder = static_cast<int>(bvhSettings.NodeOrder);
+            if (ImGui::Combo("Node order", &nodeOrder, nodeOrders, IM_ARRAYSIZE(nodeOrders))) {
+                bvhSettings.NodeOrder = static_cast<BvhNodeOrder>(nodeOrder);
+                bvhChanged = true;
+            }
+
+            if (ImGui::Button("Benchmark node orders")) {
+                mScene->BenchmarkBvhs();
+            }
+
+            if (bvhChanged) {
+                mScene->SetBvhSettings(bvhSettings);
+                mFailedShaderDefines.clear();
+                mSceneData.numFrames = 0;
+            }
+            ImGui::TreePop();
+        }
     }
     ImGui::End();
 }
 
+bool RayTracerApp::ReloadShader() {
+    mVulkanManager->WaitIdle();
+
+    // The defines are only taken over once they compiled, the old shader
+    // keeps running against the layout it was built for otherwise.
+    BvhBuildSettings settings = mScene->GetActiveBvhSettings();
+    auto defines = Scene::GetShaderDefines(settings);
+    auto* shader =
+        Shader::Create(mVulkanManager, "assets/shaders/RayTracer.comp",
+            ShaderStage::Compute, mSurface->ImageCount(), defines);
+    if (!shader) {
+        return false;
+    }
+
+    mShader = std::shared_ptr<Shader>(shader);
+    mShaderDefines = std::move(defines);
+    mShaderSettings = settings;
+    mScene->SetShader(mShader);
+
+    CreatePipeline();
+    mSceneData.numFrames = 0;
+    return true;
+}
+
+void RayTracerApp::CreatePipeline() {
+    mPipelineStackSizes = mScene->GetStackSizes();
+    mPipeline = std::make_shared<ComputePipeline>(mVulkanManager, mShader,
+        std::vector<uint32_t>{ mPipelineStackSizes.Blas, mPipelineStackSizes.Tlas,
+                               mPipelineStackSizes.Spheres });
+}
+
 void RayTracerApp::BuildScene() {
     Plane boxPlane;
     boxPlane.position = { 0, 0, 0 };
@@ -4,6 +4,7 @@
 
 #include "App/UBOs.h"
 #include "Core/AssetManager.h"
+#include "Core/MeshCache.h"
 #include "Core/VulkanComputeApp.h"
 #include "Core/Scene.h"
 #include "Vulkan/Pipeline.h"
@@ -25,14 +26,23 @@ private:
     void RenderViewport();
     void RenderSettings();
     void BuildScene();
+    bool ReloadShader();
+    void CreatePipeline();
 
     std::uniform_int_distribution<uint32_t> mRandomDistribution;
     std::mt19937 mRandomGenerator;
     std::shared_ptr<ComputePipeline> mPipeline;
     std::shared_ptr<Shader> mShader;
+    // Defines mShader was compiled with.
+    std::map<std::string, std::string> mShaderDefines;
+    // Settings mShaderDefines were generated from.
+    BvhBuildSettings mShaderSettings;
+    // Defines that last failed to compile, to not retry them every frame.
+    std::map<std::string, std::string> mFailedShaderDefines;
+    TraversalStackSizes mPipelineStackSizes;
    
     std::shared_ptr<UniformBuffer<Camera>> mCamera;
-    SceneData mSceneData{ 0, 0, 8, 16 };
+    SceneData mSceneData{ 0, 0, 8 };
     std::shared_ptr<UniformBuffer<SceneData>> mSceneDataBuffer;
 
     std::shared_ptr<Scene> mScene;
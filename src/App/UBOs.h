@@ -6,7 +6,6 @@ struct SceneData {
     uint32_t numFrames;
     uint32_t seed;
     uint32_t maxBounces;
-    uint32_t maxBvhDepth;
 };
 
 struct Camera {
@@ -36,4 +35,14 @@ struct Triangle {
     alignas(16) glm::vec3 V0;
     alignas(16) glm::vec3 V1;
     alignas(16) glm::vec3 V2;
-};
\ No newline at end of file
+};
+
+/**
+ * Triangle as uploaded to the GPU. Depending on the TriangleFormat the ray
+ * tracer is compiled with, the rows hold the vertices, the first vertex and
+ * both edges, or the Woop transform of the triangle. The indexed format
+ * uploads none.
+ */
+struct GpuTriangle {
+    glm::vec4 Rows[3];
+};
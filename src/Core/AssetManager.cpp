@@ -3,10 +3,45 @@
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <cfloat>
+#include <format>
+#include <numeric>
 
 #include "Core/Logger.h"
+#include "Core/MeshFile.h"
+#include "Core/Morton.h"
+#include "Core/ThreadPool.h"
+
+std::shared_ptr<Mesh> AssetManager::LoadMesh(const std::string& filepath, bool optimizeLayout) {
+    std::filesystem::path meshFilePath = GetMeshFilePath(filepath, optimizeLayout);
+    if (auto mesh = MeshFile::Read(meshFilePath, filepath)) {
+        return mesh;
+    }
+
+    auto mesh = ImportMesh(filepath, optimizeLayout);
+    if (mesh) {
+        MeshFile::Write(meshFilePath, filepath, *mesh);
+    }
+    return mesh;
+}
+
+std::future<std::shared_ptr<Mesh>> AssetManager::LoadMeshAsync(const std::string& filepath,
+                                                                bool optimizeLayout) {
+    return ThreadPool::Global().Submit([filepath, optimizeLayout]() {
+        return LoadMesh(filepath, optimizeLayout);
+    });
+}
+
+std::filesystem::path AssetManager::GetMeshFilePath(const std::string& filepath, bool optimizeLayout) {
+    // The hash of the whole path keeps files with the same name apart, both
+    // layouts of a file can be kept side by side.
+    std::filesystem::path path(filepath);
+    return std::filesystem::path("cache/mesh") /
+           std::format("{}-{:016x}{}.mesh", path.stem().string(), std::hash<std::string>{}(filepath),
+                       optimizeLayout ? "" : "-unordered");
+}
 
-std::shared_ptr<Mesh> AssetManager::LoadMesh(const std::string& filepath) {
+std::shared_ptr<Mesh> AssetManager::ImportMesh(const std::string& filepath, bool optimizeLayout) {
     Assimp::Importer importer;
 
     const aiScene *scene = importer.ReadFile(
@@ -19,73 +54,150 @@ std::shared_ptr<Mesh> AssetManager::LoadMesh(const std::string& filepath) {
         return nullptr;
     }
 
-    auto newMesh = std::make_shared<Mesh>();
-    ProcessNode(scene, scene->mRootNode, newMesh.get());
-
-    return newMesh;
-}
-
-void AssetManager::ProcessNode(const aiScene *scene, const aiNode *node, Mesh* outMesh) {
-    std::vector<Triangle> triangles;
-    for (uint32_t i = 0; i < node->mNumMeshes; i++) {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        auto meshTriangles = AssetManager::ProcessMesh(scene, mesh);
-        triangles.insert(triangles.end(), meshTriangles.begin(), meshTriangles.end());
+    // The meshes are independent, so their vertices are extracted in
+    // parallel before being appended to each other.
+    std::vector<MeshData> meshes(scene->mNumMeshes);
+    {
+        TaskGroup group;
+        for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+            group.Run([scene, &meshes, optimizeLayout, i]() {
+                meshes[i] = AssetManager::ProcessMesh(scene->mMeshes[i]);
+                if (optimizeLayout) {
+                    AssetManager::OptimizeLayout(meshes[i]);
+                }
+            });
+        }
+        group.Wait();
     }
-    outMesh->mTriangles = std::move(triangles);
 
-    for (uint32_t i = 0; i < node->mNumChildren; i++) {
-        auto subMesh = Mesh();
-        AssetManager::ProcessNode(scene, node->mChildren[i], &subMesh);
-        outMesh->subMeshes.push_back(std::move(subMesh));
+    // PreTransformVertices already moved every mesh into world space, so the
+    // node hierarchy carries no more information and is ignored.
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for (const auto& mesh : meshes) {
+        vertexCount += mesh.Positions.size();
+        indexCount += mesh.Indices.size();
     }
-}
 
-std::vector<Triangle> AssetManager::ProcessMesh(const aiScene* scene,
-                                                const aiMesh* mesh) {
-    std::vector<Vertex> vertices;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> uvs;
     std::vector<uint32_t> indices;
+    std::vector<SubMesh> subMeshes;
+    positions.reserve(vertexCount);
+    normals.reserve(vertexCount);
+    uvs.reserve(vertexCount);
+    indices.reserve(indexCount);
+    subMeshes.reserve(meshes.size());
+    for (const auto& mesh : meshes) {
+        auto firstVertex = static_cast<uint32_t>(positions.size());
+        subMeshes.push_back({ static_cast<uint32_t>(indices.size()),
+                              static_cast<uint32_t>(mesh.Indices.size()) });
+
+        positions.insert(positions.end(), mesh.Positions.begin(), mesh.Positions.end());
+        normals.insert(normals.end(), mesh.Normals.begin(), mesh.Normals.end());
+        uvs.insert(uvs.end(), mesh.Uvs.begin(), mesh.Uvs.end());
+        for (uint32_t index : mesh.Indices) {
+            indices.push_back(firstVertex + index);
+        }
+    }
 
-    vertices.reserve(mesh->mNumVertices);
+    return std::make_shared<Mesh>(std::move(positions), std::move(normals), std::move(uvs),
+                                  std::move(indices), std::move(subMeshes));
+}
+
+AssetManager::MeshData AssetManager::ProcessMesh(const aiMesh* mesh) {
+    MeshData data;
+    data.Positions.reserve(mesh->mNumVertices);
+    data.Normals.reserve(mesh->mNumVertices);
+    data.Uvs.reserve(mesh->mNumVertices);
+    data.Indices.reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
 
     LOG_DEBUG("Processing mesh with {} vertices",
               mesh->mNumVertices);
 
     for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-        Vertex vertex{};
+        data.Positions.emplace_back(mesh->mVertices[i].x, mesh->mVertices[i].y,
+                                    mesh->mVertices[i].z);
 
-        vertex.position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y,
-            mesh->mVertices[i].z);
-
-        vertex.normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y,
-            mesh->mNormals[i].z);
+        data.Normals.emplace_back(mesh->mNormals[i].x, mesh->mNormals[i].y,
+                                  mesh->mNormals[i].z);
 
         if (mesh->mTextureCoords[0]) {
-            vertex.uv = glm::vec2(mesh->mTextureCoords[0][i].x,
+            data.Uvs.emplace_back(mesh->mTextureCoords[0][i].x,
                                   mesh->mTextureCoords[0][i].y);
         } else {
-            vertex.uv = glm::vec2(0.0f, 0.0f);
+            data.Uvs.emplace_back(0.0f, 0.0f);
         }
-
-        vertices.push_back(vertex);
     }
 
+    // Triangulate leaves points and lines of mixed meshes as they are, only
+    // the triangles are kept.
     for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-        aiFace face = mesh->mFaces[i];
-        for (uint32_t j = 0; j < face.mNumIndices; j++) {
-            indices.push_back(face.mIndices[j]);
+        const aiFace& face = mesh->mFaces[i];
+        if (face.mNumIndices != 3) {
+            continue;
         }
+        data.Indices.insert(data.Indices.end(), face.mIndices, face.mIndices + 3);
+    }
+
+    return data;
+}
+
+void AssetManager::OptimizeLayout(MeshData& mesh) {
+    size_t triangleCount = mesh.Indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    std::vector<glm::vec3> centroids(triangleCount);
+    glm::vec3 centroidMin(FLT_MAX);
+    glm::vec3 centroidMax(-FLT_MAX);
+    for (size_t i = 0; i < triangleCount; i++) {
+        centroids[i] = (mesh.Positions[mesh.Indices[3 * i]] + mesh.Positions[mesh.Indices[3 * i + 1]] +
+                        mesh.Positions[mesh.Indices[3 * i + 2]]) / 3.0f;
+        centroidMin = glm::min(centroidMin, centroids[i]);
+        centroidMax = glm::max(centroidMax, centroids[i]);
     }
 
-    std::vector<Triangle> triangles;
-    triangles.reserve(indices.size() / 3);
-    for (size_t i = 0; i < indices.size(); i += 3) {
-        Triangle tri;
-        tri.V0 = vertices[indices[i]].position;
-        tri.V1 = vertices[indices[i + 1]].position;
-        tri.V2 = vertices[indices[i + 2]].position;
-        triangles.push_back(tri);
+    // Ten bits per axis are plenty to order triangles, the BVH build sorts
+    // them again with its own precision.
+    glm::vec3 extent = centroidMax - centroidMin;
+    glm::vec3 scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                    extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                    extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+    std::vector<uint64_t> codes(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+        codes[i] = MortonCode((centroids[i] - centroidMin) * scale, 10);
     }
 
-    return triangles;
-}
\ No newline at end of file
+    std::vector<uint32_t> order(triangleCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&codes](uint32_t a, uint32_t b) {
+        return codes[a] < codes[b];
+    });
+
+    // Vertices are renumbered in the order the sorted triangles reach them,
+    // which also drops the ones no triangle uses.
+    constexpr uint32_t UNUSED = UINT32_MAX;
+    std::vector<uint32_t> remap(mesh.Positions.size(), UNUSED);
+    MeshData optimized;
+    optimized.Positions.reserve(mesh.Positions.size());
+    optimized.Normals.reserve(mesh.Normals.size());
+    optimized.Uvs.reserve(mesh.Uvs.size());
+    optimized.Indices.reserve(mesh.Indices.size());
+    for (uint32_t triangle : order) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            uint32_t vertex = mesh.Indices[3 * triangle + corner];
+            if (remap[vertex] == UNUSED) {
+                remap[vertex] = static_cast<uint32_t>(optimized.Positions.size());
+                optimized.Positions.push_back(mesh.Positions[vertex]);
+                optimized.Normals.push_back(mesh.Normals[vertex]);
+                optimized.Uvs.push_back(mesh.Uvs[vertex]);
+            }
+            optimized.Indices.push_back(remap[vertex]);
+        }
+    }
+
+    mesh = std::move(optimized);
+}
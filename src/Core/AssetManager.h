@@ -2,6 +2,8 @@
 
 #include <glm/glm.hpp>
 #include <assimp/scene.h>
+#include <filesystem>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -11,17 +13,43 @@
 #include "Vulkan/CommandBuffer.h"
 #include "Vulkan/VulkanManager.h"
 
-struct Vertex {
-    alignas(16) glm::vec3 position;
-    alignas(16) glm::vec3 normal;
-    alignas(16) glm::vec2 uv;
-};
-
 class AssetManager {
 public:
-    static std::shared_ptr<Mesh> LoadMesh(const std::string& filepath);
+    /**
+     * @brief Loads a mesh, flattening all meshes in the file into one indexed
+     * mesh with a submesh per imported mesh.
+     *
+     * The first import of a file writes it to a native mesh file, which later
+     * loads map instead of running the importer.
+     *
+     * @param optimizeLayout Sorts the triangles of each submesh along a
+     * Morton curve over their centroids and numbers the vertices in the order
+     * the triangles first use them, so triangles close in space, and the
+     * vertices they share, are close in memory.
+     * @return The mesh, or nullptr if the import failed.
+     */
+    static std::shared_ptr<Mesh> LoadMesh(const std::string& filepath, bool optimizeLayout = true);
+    /**
+     * @brief Imports a mesh on the global thread pool.
+     *
+     * Several files can be imported at once this way, each import also
+     * extracts the vertices of its meshes in parallel.
+     *
+     * @return Future holding the mesh, or nullptr if the import failed.
+     */
+    static std::future<std::shared_ptr<Mesh>> LoadMeshAsync(const std::string& filepath,
+                                                            bool optimizeLayout = true);
 
 private:
-    static void ProcessNode(const aiScene* scene, const aiNode* node, Mesh* outMesh);
-    static std::vector<Triangle> ProcessMesh(const aiScene* scene, const aiMesh* mesh);
+    struct MeshData {
+        std::vector<glm::vec3> Positions;
+        std::vector<glm::vec3> Normals;
+        std::vector<glm::vec2> Uvs;
+        std::vector<uint32_t> Indices;
+    };
+
+    static std::filesystem::path GetMeshFilePath(const std::string& filepath, bool optimizeLayout);
+    static std::shared_ptr<Mesh> ImportMesh(const std::string& filepath, bool optimizeLayout);
+    static MeshData ProcessMesh(const aiMesh* mesh);
+    static void OptimizeLayout(MeshData& mesh);
 };
@@ -0,0 +1,211 @@
+#include "BvhBenchmark.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <random>
+
+#include "Core/Logger.h"
+
+static constexpr float EPSILON = 1e-6f;
+
+static bool IntersectTriangle(const glm::vec3& origin, const glm::vec3& direction,
+                              const Triangle& tri, float& distance) {
+    glm::vec3 edge1 = tri.V1 - tri.V0;
+    glm::vec3 edge2 = tri.V2 - tri.V0;
+    glm::vec3 rayCrossE2 = glm::cross(direction, edge2);
+    float det = glm::dot(edge1, rayCrossE2);
+    if (det > -EPSILON && det < EPSILON) {
+        return false;
+    }
+
+    float invDet = 1.0f / det;
+    glm::vec3 s = origin - tri.V0;
+    float u = invDet * glm::dot(s, rayCrossE2);
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+
+    glm::vec3 sCrossE1 = glm::cross(s, edge1);
+    float v = invDet * glm::dot(direction, sCrossE1);
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+
+    distance = invDet * glm::dot(edge2, sCrossE1);
+    return distance > EPSILON;
+}
+
+BvhBenchmark::BvhBenchmark(const BvhBuilder& builder, const BvhBuildSettings& settings,
+                           const Mesh* mesh)
+    : mBuilder(builder), mSettings(settings), mMesh(mesh) {
+    if (!mMesh) {
+        return;
+    }
+
+    auto indices = mMesh->Indices();
+    mLeafIndices.reserve(3 * mBuilder.GetTriangleIndices().size());
+    for (uint32_t triangleIndex : mBuilder.GetTriangleIndices()) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            mLeafIndices.push_back(indices[3 * triangleIndex + corner]);
+        }
+    }
+}
+
+std::vector<BvhBenchmark::Result> BvhBenchmark::Run(uint32_t rayCount, uint32_t repetitions) const {
+    const auto& bvh = mBuilder.GetBvh();
+    if (bvh.empty()) {
+        return {};
+    }
+
+    glm::vec3 centre = (bvh[0].Min + bvh[0].Max) * 0.5f;
+    glm::vec3 extent = bvh[0].Max - bvh[0].Min;
+    float radius = glm::length(extent);
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> normal;
+
+    std::vector<Ray> rays(rayCount);
+    for (auto& ray : rays) {
+        glm::vec3 onSphere = glm::normalize(glm::vec3(normal(random), normal(random), normal(random)));
+        glm::vec3 target = bvh[0].Min + extent * glm::vec3(unit(random), unit(random), unit(random));
+        ray.Origin = centre + onSphere * radius;
+        ray.Direction = glm::normalize(target - ray.Origin);
+    }
+
+    const BvhNodeOrder orders[] = { BvhNodeOrder::Build, BvhNodeOrder::DepthFirst, BvhNodeOrder::VanEmdeBoas };
+
+    const auto& triangles = mBuilder.GetTriangles();
+    auto loadTriangle = [&triangles](uint32_t index) -> const Triangle& {
+        return triangles[index];
+    };
+
+    auto positions = mMesh ? mMesh->Positions() : std::span<const glm::vec3>();
+    auto loadIndexedTriangle = [this, positions](uint32_t index) {
+        Triangle tri;
+        tri.V0 = positions[mLeafIndices[3 * index]];
+        tri.V1 = positions[mLeafIndices[3 * index + 1]];
+        tri.V2 = positions[mLeafIndices[3 * index + 2]];
+        return tri;
+    };
+
+    std::vector<Result> results;
+    std::vector<float> referenceDistances(rayCount);
+    std::vector<uint32_t> stack;
+    for (BvhNodeOrder order : orders) {
+        WideBvh nodes(bvh, mSettings.NodeWidth, mSettings.NodeQuantizationBits);
+        nodes.Reorder(order);
+
+        Result result{ order, std::numeric_limits<double>::max(), 1.0, 0.0, 0.0 };
+        uint64_t nodeVisits = 0;
+        uint32_t mismatches = 0;
+        for (uint32_t repetition = 0; repetition < std::max(repetitions, 1u); repetition++) {
+            nodeVisits = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t i = 0; i < rayCount; i++) {
+                uint32_t visits = 0;
+                float distance = Trace(nodes, rays[i], stack, visits, loadTriangle);
+                nodeVisits += visits;
+
+                // Every order holds the same tree, so the hits must match.
+                if (order == BvhNodeOrder::Build) {
+                    referenceDistances[i] = distance;
+                } else if (repetition == 0 && distance != referenceDistances[i]) {
+                    mismatches++;
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            result.Milliseconds = std::min(result.Milliseconds,
+                std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        if (mismatches > 0) {
+            LOG_WARNING("{} of {} rays hit differently after reordering the BVH nodes", mismatches, rayCount);
+        }
+
+        if (mMesh) {
+            result.IndexedMilliseconds = std::numeric_limits<double>::max();
+            for (uint32_t repetition = 0; repetition < std::max(repetitions, 1u); repetition++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                for (uint32_t i = 0; i < rayCount; i++) {
+                    uint32_t visits = 0;
+                    Trace(nodes, rays[i], stack, visits, loadIndexedTriangle);
+                }
+                auto end = std::chrono::high_resolution_clock::now();
+                result.IndexedMilliseconds = std::min(result.IndexedMilliseconds,
+                    std::chrono::duration<double, std::milli>(end - start).count());
+            }
+        }
+
+        result.NodesPerRay = static_cast<double>(nodeVisits) / rayCount;
+        result.Speedup = results.empty() ? 1.0 : results[0].Milliseconds / result.Milliseconds;
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+template <typename LoadTriangle>
+float BvhBenchmark::Trace(const WideBvh& nodes, const Ray& ray, std::vector<uint32_t>& stack,
+                          uint32_t& nodeVisits, const LoadTriangle& loadTriangle) const {
+    glm::vec3 invDir = 1.0f / ray.Direction;
+    float closest = std::numeric_limits<float>::max();
+
+    std::array<WideBvh::Child, 8> children;
+    std::array<uint32_t, 8> hitChildren;
+    std::array<float, 8> hitDistances;
+
+    stack.assign(1, 0);
+    while (!stack.empty()) {
+        uint32_t nodeIndex = stack.back();
+        stack.pop_back();
+        nodeVisits++;
+
+        uint32_t hitCount = 0;
+        uint32_t childCount = nodes.LoadChildren(nodeIndex, children.data());
+        for (uint32_t i = 0; i < childCount; i++) {
+            const WideBvh::Child& child = children[i];
+            glm::vec3 t0s = (child.Bounds.Min - ray.Origin) * invDir;
+            glm::vec3 t1s = (child.Bounds.Max - ray.Origin) * invDir;
+            glm::vec3 tSmalls = glm::min(t0s, t1s);
+            glm::vec3 tBigs = glm::max(t0s, t1s);
+            float tMin = std::max(std::max(tSmalls.x, tSmalls.y), tSmalls.z);
+            float tMax = std::min(std::min(tBigs.x, tBigs.y), tBigs.z);
+            if (tMax < std::max(tMin, 0.0f) || tMin >= closest) {
+                continue;
+            }
+
+            if (child.TriangleCount > 0) {
+                for (uint32_t j = child.Index; j < child.Index + child.TriangleCount; j++) {
+                    float distance;
+                    if (IntersectTriangle(ray.Origin, ray.Direction, loadTriangle(j), distance) &&
+                        distance < closest) {
+                        closest = distance;
+                    }
+                }
+                continue;
+            }
+
+            // Sorted by decreasing distance, so the nearest child is popped
+            // first.
+            uint32_t j = hitCount++;
+            while (j > 0 && hitDistances[j - 1] < tMin) {
+                hitChildren[j] = hitChildren[j - 1];
+                hitDistances[j] = hitDistances[j - 1];
+                j--;
+            }
+            hitChildren[j] = child.Index;
+            hitDistances[j] = tMin;
+        }
+
+        for (uint32_t i = 0; i < hitCount; i++) {
+            if (hitDistances[i] < closest) {
+                stack.push_back(hitChildren[i]);
+            }
+        }
+    }
+
+    return closest;
+}
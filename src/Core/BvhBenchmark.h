@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "Core/BvhBuilder.h"
+#include "Core/WideBvh.h"
+
+/**
+ * @brief Compares the node orders of a mesh BVH by tracing rays through its
+ * GPU node layout on the CPU.
+ *
+ * The traversal mirrors intersectBvh in RayTracer.comp. Every order is traced
+ * with the same incoherent rays, cast from a sphere around the mesh towards
+ * random points inside its box, so the timings only differ by how the nodes
+ * are placed in memory.
+ */
+class BvhBenchmark {
+public:
+    struct Result {
+        BvhNodeOrder Order;
+        double Milliseconds;
+        // Traversal speed relative to the Build order.
+        double Speedup;
+        double NodesPerRay;
+        // Time taken when the triangles are fetched through the mesh indices,
+        // 0 without a mesh.
+        double IndexedMilliseconds;
+    };
+
+    /**
+     * @param builder Builder holding the tree to benchmark.
+     * @param settings Settings the GPU nodes are collapsed with.
+     * @param mesh Mesh the tree was built from. When given, the rays are also
+     * traced fetching the vertices of each leaf through the mesh indices, as
+     * the indexed triangle format does, so the timings show how well the
+     * vertex order of the mesh matches the tree.
+     */
+    BvhBenchmark(const BvhBuilder& builder, const BvhBuildSettings& settings,
+                 const Mesh* mesh = nullptr);
+
+    /**
+     * @brief Traces the rays through every node order and keeps the fastest
+     * of the repetitions for each.
+     */
+    std::vector<Result> Run(uint32_t rayCount = 1 << 16, uint32_t repetitions = 3) const;
+
+private:
+    struct Ray {
+        glm::vec3 Origin;
+        glm::vec3 Direction;
+    };
+
+    template <typename LoadTriangle>
+    float Trace(const WideBvh& nodes, const Ray& ray, std::vector<uint32_t>& stack,
+                uint32_t& nodeVisits, const LoadTriangle& loadTriangle) const;
+
+    const BvhBuilder& mBuilder;
+    BvhBuildSettings mSettings;
+    const Mesh* mMesh;
+    // Vertex indices of the triangles in the leaf order of the tree.
+    std::vector<uint32_t> mLeafIndices;
+};
@@ -1,5 +1,12 @@
 #include "BvhBuilder.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "Core/Morton.h"
+#include "Core/ThreadPool.h"
+
 enum class SplitAxis {
     X,
     Y,
@@ -11,12 +18,26 @@ void Grow(BvhNode& node, const Triangle& triangle) {
     node.Max = glm::max(node.Max, glm::max(triangle.V0, glm::max(triangle.V1, triangle.V2)));
 }
 
-bool IsLeft(const Triangle& triangle, SplitAxis axis, float splitPos) {
-    float centre = (triangle.V0[static_cast<int>(axis)] +
-        triangle.V1[static_cast<int>(axis)] +
-        triangle.V2[static_cast<int>(axis)]) / 3.0f;
+void Grow(BvhNode& node, const PrimitiveBounds& bounds) {
+    node.Min = glm::min(node.Min, bounds.Min);
+    node.Max = glm::max(node.Max, bounds.Max);
+}
 
-    return centre < splitPos;
+float Centroid(const PrimitiveBounds& bounds, SplitAxis axis) {
+    return (bounds.Min[static_cast<int>(axis)] + bounds.Max[static_cast<int>(axis)]) * 0.5f;
+}
+
+float SurfaceArea(const BvhNode& node) {
+    if (node.Min.x > node.Max.x) {
+        return 0.0f;
+    }
+
+    glm::vec3 extents = node.Max - node.Min;
+    return 2.0f * (extents.x * extents.y + extents.y * extents.z + extents.z * extents.x);
+}
+
+bool IsLeft(const PrimitiveBounds& bounds, SplitAxis axis, float splitPos) {
+    return Centroid(bounds, axis) < splitPos;
 }
 
 void GetLongestAxis(const BvhNode& node, SplitAxis& axis, float& pos) {
@@ -33,69 +54,1068 @@ void GetLongestAxis(const BvhNode& node, SplitAxis& axis, float& pos) {
     }
 }
 
+struct SahBin {
+    BvhNode Bounds;
+    uint32_t Count{ 0 };
+};
+
+/**
+ * Evaluates the binned surface area heuristic on every axis of the node and
+ * returns the cheapest split plane. Returns false when keeping the node as a
+ * leaf is cheaper than any split.
+ */
+bool FindSahSplit(const std::vector<PrimitiveBounds>& bounds, const std::vector<uint32_t>& primitives,
+                  const BvhNode& node, const BvhBuildSettings& settings, SplitAxis& axis, float& pos) {
+    const uint32_t binCount = std::max(settings.BinCount, 2u);
+    const float parentArea = SurfaceArea(node);
+    if (node.TriangleCount <= 1 || parentArea <= 0.0f) {
+        return false;
+    }
+
+    glm::vec3 centroidMin{ FLT_MAX };
+    glm::vec3 centroidMax{ -FLT_MAX };
+    for (uint32_t i = node.TriangleIndex; i < node.TriangleIndex + node.TriangleCount; i++) {
+        for (int a = 0; a < 3; a++) {
+            float centre = Centroid(bounds[primitives[i]], static_cast<SplitAxis>(a));
+            centroidMin[a] = std::min(centroidMin[a], centre);
+            centroidMax[a] = std::max(centroidMax[a], centre);
+        }
+    }
+
+    float bestCost = FLT_MAX;
+    std::vector<SahBin> bins(binCount);
+    std::vector<float> leftCosts(binCount - 1);
+    for (int a = 0; a < 3; a++) {
+        float extent = centroidMax[a] - centroidMin[a];
+        if (extent <= 0.0f) {
+            continue;
+        }
+
+        std::fill(bins.begin(), bins.end(), SahBin{});
+        float scale = static_cast<float>(binCount) / extent;
+        for (uint32_t i = node.TriangleIndex; i < node.TriangleIndex + node.TriangleCount; i++) {
+            const PrimitiveBounds& primitive = bounds[primitives[i]];
+            float centre = Centroid(primitive, static_cast<SplitAxis>(a));
+            uint32_t bin = std::min(binCount - 1, static_cast<uint32_t>((centre - centroidMin[a]) * scale));
+            Grow(bins[bin].Bounds, primitive);
+            bins[bin].Count++;
+        }
+
+        BvhNode leftBounds;
+        uint32_t leftCount = 0;
+        for (uint32_t i = 0; i < binCount - 1; i++) {
+            leftBounds.Min = glm::min(leftBounds.Min, bins[i].Bounds.Min);
+            leftBounds.Max = glm::max(leftBounds.Max, bins[i].Bounds.Max);
+            leftCount += bins[i].Count;
+            leftCosts[i] = SurfaceArea(leftBounds) * leftCount;
+        }
+
+        BvhNode rightBounds;
+        uint32_t rightCount = 0;
+        for (uint32_t i = binCount - 1; i > 0; i--) {
+            rightBounds.Min = glm::min(rightBounds.Min, bins[i].Bounds.Min);
+            rightBounds.Max = glm::max(rightBounds.Max, bins[i].Bounds.Max);
+            rightCount += bins[i].Count;
+
+            float cost = leftCosts[i - 1] + SurfaceArea(rightBounds) * rightCount;
+            if (cost < bestCost) {
+                bestCost = cost;
+                axis = static_cast<SplitAxis>(a);
+                pos = centroidMin[a] + extent * static_cast<float>(i) / static_cast<float>(binCount);
+            }
+        }
+    }
+
+    float splitCost = settings.TraversalCost + settings.IntersectionCost * bestCost / parentArea;
+    float leafCost = settings.IntersectionCost * node.TriangleCount;
+
+    return bestCost < FLT_MAX && splitCost < leafCost;
+}
+
+struct SplitCandidate {
+    float Cost{ FLT_MAX };
+    int Axis{ 0 };
+    float Pos{ 0.0f };
+    BvhNode Left;
+    BvhNode Right;
+};
+
+void Grow(BvhNode& node, const glm::vec3& point) {
+    node.Min = glm::min(node.Min, point);
+    node.Max = glm::max(node.Max, point);
+}
+
+void Grow(BvhNode& node, const BvhNode& other) {
+    node.Min = glm::min(node.Min, other.Min);
+    node.Max = glm::max(node.Max, other.Max);
+}
+
+BvhNode Intersect(const BvhNode& a, const BvhNode& b) {
+    BvhNode result;
+    result.Min = glm::max(a.Min, b.Min);
+    result.Max = glm::min(a.Max, b.Max);
+    if (result.Min.x > result.Max.x || result.Min.y > result.Max.y || result.Min.z > result.Max.z) {
+        return BvhNode{};
+    }
+
+    return result;
+}
+
+/**
+ * Clips the part of the triangle inside bounds against the plane at pos and
+ * returns the boxes of both halves.
+ */
+void SplitReference(const Triangle& triangle, const BvhNode& bounds, int axis, float pos,
+                    BvhNode& left, BvhNode& right) {
+    left = BvhNode{};
+    right = BvhNode{};
+
+    const glm::vec3* vertices[] = { &triangle.V0, &triangle.V1, &triangle.V2 };
+    for (int i = 0; i < 3; i++) {
+        const glm::vec3& v0 = *vertices[i];
+        const glm::vec3& v1 = *vertices[(i + 1) % 3];
+        if (v0[axis] <= pos) {
+            Grow(left, v0);
+        }
+        if (v0[axis] >= pos) {
+            Grow(right, v0);
+        }
+
+        if ((v0[axis] < pos && v1[axis] > pos) || (v0[axis] > pos && v1[axis] < pos)) {
+            glm::vec3 point = glm::mix(v0, v1, (pos - v0[axis]) / (v1[axis] - v0[axis]));
+            point[axis] = pos;
+            Grow(left, point);
+            Grow(right, point);
+        }
+    }
+
+    left = Intersect(left, bounds);
+    right = Intersect(right, bounds);
+}
+
+/**
+ * Binned SAH over the centroids of the reference boxes, the same split the
+ * binned SAH builder uses but without moving any triangles.
+ */
+SplitCandidate FindObjectSplit(const std::vector<TriangleReference>& references, uint32_t binCount) {
+    SplitCandidate best;
+
+    BvhNode centroids;
+    for (const auto& reference : references) {
+        Grow(centroids, (reference.Bounds.Min + reference.Bounds.Max) * 0.5f);
+    }
+
+    std::vector<SahBin> bins(binCount);
+    std::vector<BvhNode> leftBounds(binCount - 1);
+    std::vector<uint32_t> leftCounts(binCount - 1);
+    for (int a = 0; a < 3; a++) {
+        float extent = centroids.Max[a] - centroids.Min[a];
+        if (extent <= 0.0f) {
+            continue;
+        }
+
+        std::fill(bins.begin(), bins.end(), SahBin{});
+        float scale = static_cast<float>(binCount) / extent;
+        for (const auto& reference : references) {
+            float centre = (reference.Bounds.Min[a] + reference.Bounds.Max[a]) * 0.5f;
+            uint32_t bin = std::min(binCount - 1, static_cast<uint32_t>((centre - centroids.Min[a]) * scale));
+            Grow(bins[bin].Bounds, reference.Bounds);
+            bins[bin].Count++;
+        }
+
+        BvhNode left;
+        uint32_t leftCount = 0;
+        for (uint32_t i = 0; i < binCount - 1; i++) {
+            Grow(left, bins[i].Bounds);
+            leftCount += bins[i].Count;
+            leftBounds[i] = left;
+            leftCounts[i] = leftCount;
+        }
+
+        BvhNode right;
+        uint32_t rightCount = 0;
+        for (uint32_t i = binCount - 1; i > 0; i--) {
+            Grow(right, bins[i].Bounds);
+            rightCount += bins[i].Count;
+            if (leftCounts[i - 1] == 0 || rightCount == 0) {
+                continue;
+            }
+
+            float cost = SurfaceArea(leftBounds[i - 1]) * leftCounts[i - 1] + SurfaceArea(right) * rightCount;
+            if (cost < best.Cost) {
+                best.Cost = cost;
+                best.Axis = a;
+                best.Pos = centroids.Min[a] + extent * static_cast<float>(i) / static_cast<float>(binCount);
+                best.Left = leftBounds[i - 1];
+                best.Right = right;
+            }
+        }
+    }
+
+    return best;
+}
+
+struct SpatialBin {
+    BvhNode Bounds;
+    uint32_t Enter{ 0 };
+    uint32_t Exit{ 0 };
+};
+
+/**
+ * Evaluates split planes at fixed positions inside the node, clipping every
+ * reference into the bins it overlaps so straddling triangles count on both
+ * sides with only the part that lies there.
+ */
+SplitCandidate FindSpatialSplit(const std::vector<TriangleReference>& references,
+                                const std::vector<Triangle>& triangles,
+                                const BvhNode& node, uint32_t binCount) {
+    SplitCandidate best;
 
-BvhBuilder::BvhBuilder(const Model& model, uint32_t maxDepth)
-    : mModel(model), mMaxDepth(maxDepth) {
-    for (const auto tri : model.GetMesh().Triangles()) {
-        Triangle transformedTri = tri;
-        transformedTri.V0 = model.GetModelMatrix() * glm::vec4(tri.V0, 1.0f);
-        transformedTri.V1 = model.GetModelMatrix() * glm::vec4(tri.V1, 1.0f);
-        transformedTri.V2 = model.GetModelMatrix() * glm::vec4(tri.V2, 1.0f);
-        
-        mTriangles.push_back(transformedTri);
+    std::vector<SpatialBin> bins(binCount);
+    std::vector<BvhNode> leftBounds(binCount - 1);
+    std::vector<uint32_t> leftCounts(binCount - 1);
+    for (int a = 0; a < 3; a++) {
+        float extent = node.Max[a] - node.Min[a];
+        if (extent <= 0.0f) {
+            continue;
+        }
+
+        std::fill(bins.begin(), bins.end(), SpatialBin{});
+        float binWidth = extent / static_cast<float>(binCount);
+        auto binOf = [&](float value) {
+            return std::min(binCount - 1, static_cast<uint32_t>(std::max(value - node.Min[a], 0.0f) / binWidth));
+        };
+
+        for (const auto& reference : references) {
+            uint32_t firstBin = binOf(reference.Bounds.Min[a]);
+            uint32_t lastBin = binOf(reference.Bounds.Max[a]);
+
+            BvhNode remaining = reference.Bounds;
+            for (uint32_t bin = firstBin; bin < lastBin; bin++) {
+                BvhNode left;
+                BvhNode right;
+                float plane = node.Min[a] + binWidth * static_cast<float>(bin + 1);
+                SplitReference(triangles[reference.Triangle], remaining, a, plane, left, right);
+                Grow(bins[bin].Bounds, left);
+                remaining = right;
+            }
+            Grow(bins[lastBin].Bounds, remaining);
+
+            bins[firstBin].Enter++;
+            bins[lastBin].Exit++;
+        }
+
+        BvhNode left;
+        uint32_t leftCount = 0;
+        for (uint32_t i = 0; i < binCount - 1; i++) {
+            Grow(left, bins[i].Bounds);
+            leftCount += bins[i].Enter;
+            leftBounds[i] = left;
+            leftCounts[i] = leftCount;
+        }
+
+        BvhNode right;
+        uint32_t rightCount = 0;
+        for (uint32_t i = binCount - 1; i > 0; i--) {
+            Grow(right, bins[i].Bounds);
+            rightCount += bins[i].Exit;
+            if (leftCounts[i - 1] == 0 || rightCount == 0) {
+                continue;
+            }
+
+            float cost = SurfaceArea(leftBounds[i - 1]) * leftCounts[i - 1] + SurfaceArea(right) * rightCount;
+            if (cost < best.Cost) {
+                best.Cost = cost;
+                best.Axis = a;
+                best.Pos = node.Min[a] + binWidth * static_cast<float>(i);
+                best.Left = leftBounds[i - 1];
+                best.Right = right;
+            }
+        }
     }
+
+    return best;
+}
+
+/**
+ * Sorts the keys together with their values with a least significant digit
+ * radix sort, one byte per pass.
+ */
+void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits) {
+    std::vector<uint64_t> sortedKeys(keys.size());
+    std::vector<uint32_t> sortedValues(values.size());
+
+    for (uint32_t shift = 0; shift < keyBits; shift += 8) {
+        std::array<size_t, 256> offsets{};
+        for (uint64_t key : keys) {
+            offsets[(key >> shift) & 0xff]++;
+        }
+
+        size_t offset = 0;
+        for (auto& count : offsets) {
+            size_t digitCount = count;
+            count = offset;
+            offset += digitCount;
+        }
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            size_t destination = offsets[(keys[i] >> shift) & 0xff]++;
+            sortedKeys[destination] = keys[i];
+            sortedValues[destination] = values[i];
+        }
+
+        keys.swap(sortedKeys);
+        values.swap(sortedValues);
+    }
+}
+
+/**
+ * Returns the last index of the left half of the sorted range [first, last],
+ * which is where the highest differing bit of the codes changes value.
+ */
+uint32_t FindMortonSplit(const std::vector<uint64_t>& codes, uint32_t first, uint32_t last) {
+    uint64_t firstCode = codes[first];
+    uint64_t lastCode = codes[last];
+    if (firstCode == lastCode) {
+        return (first + last) >> 1;
+    }
+
+    int commonPrefix = std::countl_zero(firstCode ^ lastCode);
+
+    uint32_t split = first;
+    uint32_t step = last - first;
+    do {
+        step = (step + 1) >> 1;
+        uint32_t newSplit = split + step;
+        if (newSplit < last && std::countl_zero(firstCode ^ codes[newSplit]) > commonPrefix) {
+            split = newSplit;
+        }
+    } while (step > 1);
+
+    return split;
+}
+
+BvhBuilder::BvhBuilder(const Mesh& mesh, const BvhBuildSettings& settings, const glm::mat4& transform)
+    : mSourceTriangleCount(static_cast<uint32_t>(mesh.TriangleCount())),
+      mSettings(settings) {
+    mTriangleIndices.resize(mesh.TriangleCount());
+    for (uint32_t i = 0; i < mTriangleIndices.size(); i++) {
+        mTriangleIndices[i] = i;
+    }
+
+    TransformTriangles(mesh, transform);
+}
+
+BvhBuilder::BvhBuilder(const Model& model, const BvhBuildSettings& settings)
+    : BvhBuilder(model.GetMesh(), settings, model.GetModelMatrix()) {}
+
+BvhBuilder::BvhBuilder(std::vector<PrimitiveBounds> primitives, const BvhBuildSettings& settings)
+    : mPrimitiveBounds(std::move(primitives)),
+      mHasTriangles(false),
+      mSourceTriangleCount(static_cast<uint32_t>(mPrimitiveBounds.size())),
+      mSettings(settings) {
+    mTriangleIndices.resize(mPrimitiveBounds.size());
+    for (uint32_t i = 0; i < mTriangleIndices.size(); i++) {
+        mTriangleIndices[i] = i;
+    }
+}
+
+BvhBuilder::BvhBuilder(const BvhBuilder& other)
+    : mBvh(other.mBvh),
+      mTriangles(other.mTriangles),
+      mTriangleIndices(other.mTriangleIndices),
+      mPrimitiveBounds(other.mHasTriangles ? std::vector<PrimitiveBounds>() : other.mPrimitiveBounds),
+      mHasTriangles(other.mHasTriangles),
+      mSourceTriangleCount(other.mSourceTriangleCount),
+      mSettings(other.mSettings),
+      mDepth(other.mDepth),
+      mSahCost(other.mSahCost),
+      mBuildSahCost(other.mBuildSahCost) {}
+
+void BvhBuilder::TransformTriangles(const Mesh& mesh, const glm::mat4& transform) {
+    mTriangles.resize(mTriangleIndices.size());
+
+    auto transformRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Triangle tri = mesh.GetTriangle(mTriangleIndices[i]);
+            mTriangles[i].V0 = transform * glm::vec4(tri.V0, 1.0f);
+            mTriangles[i].V1 = transform * glm::vec4(tri.V1, 1.0f);
+            mTriangles[i].V2 = transform * glm::vec4(tri.V2, 1.0f);
+        }
+    };
+
+    if (mSettings.Parallel && mTriangles.size() >= mSettings.ParallelThreshold) {
+        TaskGroup tasks;
+        for (size_t begin = 0; begin < mTriangles.size(); begin += mSettings.ParallelThreshold) {
+            size_t end = std::min(begin + mSettings.ParallelThreshold, mTriangles.size());
+            tasks.Run([&transformRange, begin, end]() { transformRange(begin, end); });
+        }
+        tasks.Wait();
+    } else {
+        transformRange(0, mTriangles.size());
+    }
+}
+
+void BvhBuilder::RemoveDuplicateReferences() {
+    if (mTriangleIndices.size() == mSourceTriangleCount) {
+        return;
+    }
+
+    std::vector<bool> kept(mSourceTriangleCount, false);
+    size_t count = 0;
+    for (size_t i = 0; i < mTriangleIndices.size(); i++) {
+        if (kept[mTriangleIndices[i]]) {
+            continue;
+        }
+
+        kept[mTriangleIndices[i]] = true;
+        mTriangles[count] = mTriangles[i];
+        mTriangleIndices[count] = mTriangleIndices[i];
+        count++;
+    }
+
+    mTriangles.resize(count);
+    mTriangleIndices.resize(count);
 }
 
 void BvhBuilder::Build(bool printStats) {
     mBvh.clear();
-    mBvh.reserve(pow(2, mMaxDepth));  
+    mArenas.clear();
+
+    // A previous SBVH build leaves duplicated references behind.
+    RemoveDuplicateReferences();
+
+    // Splits only move 32-bit primitive indices around and read the boxes of
+    // the primitives, the triangles themselves stay in place until they are
+    // gathered in leaf order once the tree is complete.
+    if (mHasTriangles) {
+        mPrimitiveBounds.resize(mTriangles.size());
+        for (uint32_t i = 0; i < mTriangles.size(); i++) {
+            const Triangle& tri = mTriangles[i];
+            mPrimitiveBounds[i].Min = glm::min(tri.V0, glm::min(tri.V1, tri.V2));
+            mPrimitiveBounds[i].Max = glm::max(tri.V0, glm::max(tri.V1, tri.V2));
+        }
+    }
 
     BvhNode root;
-    root.TriangleCount = static_cast<uint32_t>(mTriangles.size());
+    root.TriangleCount = static_cast<uint32_t>(mPrimitiveBounds.size());
+    mPrimitives.resize(mPrimitiveBounds.size());
+    for (uint32_t i = 0; i < mPrimitiveBounds.size(); i++) {
+        mPrimitives[i] = i;
+        Grow(root, mPrimitiveBounds[i]);
+    }
 
-    for (const auto& tri : mTriangles) {
-        Grow(root, tri);
+    if (mSettings.SplitMethod == BvhSplitMethod::Sbvh && mHasTriangles) {
+        std::vector<TriangleReference> references(mTriangles.size());
+        for (uint32_t i = 0; i < references.size(); i++) {
+            Grow(references[i].Bounds, mPrimitiveBounds[i]);
+            references[i].Triangle = i;
+        }
+
+        std::vector<uint32_t> primitives;
+        uint32_t budget = static_cast<uint32_t>(mTriangles.size() * std::max(mSettings.SpatialSplitBudget, 0.0f));
+        primitives.reserve(mTriangles.size() + budget);
+        mBvh.reserve(2 * (mTriangles.size() + budget) + 1);
+
+        // Spatial splits are evaluated on a single thread, the reference
+        // lists of the children are only known after the parent is split.
+        mBvh.push_back(root);
+        BuildSpatialLayer(0, references, 1, budget, SurfaceArea(root), primitives);
+
+        mPrimitives = std::move(primitives);
+    } else {
+        uint32_t rootArenaIndex;
+        NodeArena& rootArena = CreateArena(rootArenaIndex);
+        rootArena.Nodes.reserve(2 * static_cast<size_t>(root.TriangleCount) + 1);
+        rootArena.Nodes.push_back(root);
+
+        if (mSettings.Parallel && root.TriangleCount >= mSettings.ParallelThreshold) {
+            TaskGroup tasks;
+            if (mSettings.SplitMethod == BvhSplitMethod::Lbvh) {
+                SortByMortonCode(root, &tasks);
+            }
+            BuildLayer(rootArena, 0, 1, &tasks);
+            tasks.Wait();
+        } else {
+            if (mSettings.SplitMethod == BvhSplitMethod::Lbvh) {
+                SortByMortonCode(root, nullptr);
+            }
+            BuildLayer(rootArena, 0, 1, nullptr);
+        }
+
+        if (mArenas.size() == 1) {
+            mBvh = std::move(rootArena.Nodes);
+        } else {
+            size_t nodeCount = 0;
+            for (const auto& arena : mArenas) {
+                nodeCount += arena->Nodes.size();
+            }
+
+            // Every arena but the root one starts with a copy of a node that is
+            // already stored in its parent arena.
+            mBvh.reserve(nodeCount - (mArenas.size() - 1));
+            mBvh.emplace_back();
+            Flatten(rootArena, 0, 0);
+        }
+        mArenas.clear();
+        mMortonCodes.clear();
     }
 
-    mBvh.push_back(root);
+    GatherPrimitives();
 
-    BuildLayer(mBvh[0], 1);
+    // The LBVH only emits the topology, bounds are filled in a single
+    // bottom-up pass.
+    if (mSettings.SplitMethod == BvhSplitMethod::Lbvh) {
+        RefitNode(0, mSettings.Parallel);
+    }
+
+    if (mSettings.OptimizeTreelets) {
+        RotateTreelets();
+    }
+
+    // Storage was reserved for the worst case of one triangle per leaf.
+    mBvh.shrink_to_fit();
+
+    mSahCost = ComputeSahCost();
+    mBuildSahCost = mSahCost;
+    mDepth = ComputeDepth();
 
     if (printStats) {
         PrintStats();
     }
 }
 
-void BvhBuilder::BuildLayer(BvhNode& parent, uint32_t depth) {
-    if (depth >= mMaxDepth) {
-        return;
+bool BvhBuilder::Restore(std::vector<BvhNode> bvh, std::vector<Triangle> triangles,
+                         std::vector<uint32_t> triangleIndices) {
+    if (bvh.empty() || triangles.size() != triangleIndices.size() ||
+        triangles.size() < mSourceTriangleCount) {
+        return false;
+    }
+
+    for (uint32_t index : triangleIndices) {
+        if (index >= mSourceTriangleCount) {
+            return false;
+        }
+    }
+
+    // Children are always stored after their parent, which also rules out
+    // cycles in the restored tree.
+    for (size_t i = 0; i < bvh.size(); i++) {
+        const BvhNode& node = bvh[i];
+        bool valid = node.ChildIndex != 0
+            ? node.ChildIndex > i && node.ChildIndex + 1 < bvh.size()
+            : static_cast<uint64_t>(node.TriangleIndex) + node.TriangleCount <= triangles.size();
+        if (!valid) {
+            return false;
+        }
     }
 
-    parent.ChildIndex = static_cast<uint32_t>(mBvh.size());
-    BvhNode& leftChild = mBvh.emplace_back();
-    BvhNode& rightChild = mBvh.emplace_back();
+    mBvh = std::move(bvh);
+    mTriangles = std::move(triangles);
+    mTriangleIndices = std::move(triangleIndices);
+
+    mSahCost = ComputeSahCost();
+    mBuildSahCost = mSahCost;
+    mDepth = ComputeDepth();
+    return true;
+}
+
+void BvhBuilder::GatherPrimitives() {
+    std::vector<uint32_t> indices(mPrimitives.size());
+    for (size_t i = 0; i < mPrimitives.size(); i++) {
+        indices[i] = mTriangleIndices[mPrimitives[i]];
+    }
+    mTriangleIndices = std::move(indices);
+
+    if (mHasTriangles) {
+        std::vector<Triangle> triangles(mPrimitives.size());
+        for (size_t i = 0; i < mPrimitives.size(); i++) {
+            triangles[i] = mTriangles[mPrimitives[i]];
+        }
+        mTriangles = std::move(triangles);
+
+        mPrimitiveBounds.clear();
+        mPrimitiveBounds.shrink_to_fit();
+    } else {
+        std::vector<PrimitiveBounds> bounds(mPrimitives.size());
+        for (size_t i = 0; i < mPrimitives.size(); i++) {
+            bounds[i] = mPrimitiveBounds[mPrimitives[i]];
+        }
+        mPrimitiveBounds = std::move(bounds);
+    }
+
+    mPrimitives.clear();
+    mPrimitives.shrink_to_fit();
+}
+
+BvhBuilder::NodeArena& BvhBuilder::CreateArena(uint32_t& arenaIndex) {
+    std::lock_guard lock(mArenasMutex);
+    arenaIndex = static_cast<uint32_t>(mArenas.size());
+    return *mArenas.emplace_back(std::make_unique<NodeArena>());
+}
+
+void BvhBuilder::SortByMortonCode(const BvhNode& root, TaskGroup* tasks) {
+    glm::vec3 centroidMin{ FLT_MAX };
+    glm::vec3 centroidMax{ -FLT_MAX };
+    for (const auto& bounds : mPrimitiveBounds) {
+        glm::vec3 centre = (bounds.Min + bounds.Max) * 0.5f;
+        centroidMin = glm::min(centroidMin, centre);
+        centroidMax = glm::max(centroidMax, centre);
+    }
+
+    glm::vec3 extents = centroidMax - centroidMin;
+    glm::vec3 scale = glm::vec3(
+        extents.x > 0.0f ? 1.0f / extents.x : 0.0f,
+        extents.y > 0.0f ? 1.0f / extents.y : 0.0f,
+        extents.z > 0.0f ? 1.0f / extents.z : 0.0f);
+    uint32_t bitsPerAxis = mSettings.MortonCodeBits > 30 ? 21 : 10;
+
+    std::vector<uint64_t> codes(mPrimitiveBounds.size());
+    auto computeCodes = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            glm::vec3 centre = (mPrimitiveBounds[i].Min + mPrimitiveBounds[i].Max) * 0.5f;
+            codes[i] = MortonCode((centre - centroidMin) * scale, bitsPerAxis);
+        }
+    };
+
+    if (tasks) {
+        TaskGroup codeTasks;
+        for (size_t begin = 0; begin < codes.size(); begin += mSettings.ParallelThreshold) {
+            size_t end = std::min(begin + mSettings.ParallelThreshold, codes.size());
+            codeTasks.Run([&computeCodes, begin, end]() { computeCodes(begin, end); });
+        }
+        codeTasks.Wait();
+    } else {
+        computeCodes(0, codes.size());
+    }
+
+    // The primitive indices still hold the identity permutation here.
+    RadixSort(codes, mPrimitives, bitsPerAxis * 3);
+    mMortonCodes = std::move(codes);
+}
+
+bool BvhBuilder::SplitNode(const BvhNode& parent, BvhNode& leftChild, BvhNode& rightChild) {
     leftChild.TriangleIndex = parent.TriangleIndex;
     rightChild.TriangleIndex = parent.TriangleIndex;
 
+    if (parent.TriangleCount <= std::max(mSettings.MaxLeafSize, 1u)) {
+        return false;
+    }
+
+    // Triangles are already sorted along the Morton curve, so the children
+    // are the two halves of the range split at the first differing bit.
+    if (mSettings.SplitMethod == BvhSplitMethod::Lbvh) {
+        uint32_t last = parent.TriangleIndex + parent.TriangleCount - 1;
+        uint32_t split = FindMortonSplit(mMortonCodes, parent.TriangleIndex, last);
+        leftChild.TriangleCount = split - parent.TriangleIndex + 1;
+        rightChild.TriangleIndex = split + 1;
+        rightChild.TriangleCount = last - split;
+        return true;
+    }
+
     SplitAxis splitAxis;
     float splitPos;
-    GetLongestAxis(parent, splitAxis, splitPos);
+    // Builders without triangles fall back from the SBVH to the binned SAH.
+    if (mSettings.SplitMethod == BvhSplitMethod::BinnedSah || mSettings.SplitMethod == BvhSplitMethod::Sbvh) {
+        if (!FindSahSplit(mPrimitiveBounds, mPrimitives, parent, mSettings, splitAxis, splitPos)) {
+            return false;
+        }
+    } else {
+        GetLongestAxis(parent, splitAxis, splitPos);
+    }
 
     for (uint32_t i = parent.TriangleIndex; i < parent.TriangleIndex + parent.TriangleCount; i++) {
-        bool isLeft = IsLeft(mTriangles[i], splitAxis, splitPos);
+        const PrimitiveBounds& bounds = mPrimitiveBounds[mPrimitives[i]];
+        bool isLeft = IsLeft(bounds, splitAxis, splitPos);
         BvhNode& child = isLeft ? leftChild : rightChild;
-        Grow(child, mTriangles[i]);
+        Grow(child, bounds);
         child.TriangleCount++;
 
         if (isLeft) {
-            int swapIndex = child.TriangleIndex + child.TriangleCount - 1;
-            std::swap(mTriangles[i], mTriangles[swapIndex]);
+            uint32_t swapIndex = child.TriangleIndex + child.TriangleCount - 1;
+            std::swap(mPrimitives[i], mPrimitives[swapIndex]);
             rightChild.TriangleIndex++;
         }
     }
 
-    BuildLayer(leftChild, depth + 1);
-    BuildLayer(rightChild, depth + 1);
+    // Coincident centroids put everything on one side of the midpoint.
+    return leftChild.TriangleCount > 0 && rightChild.TriangleCount > 0;
+}
+
+bool BvhBuilder::Refit(const Mesh& mesh, const glm::mat4& transform) {
+    if (mBvh.empty() || mesh.TriangleCount() != mSourceTriangleCount) {
+        mSourceTriangleCount = static_cast<uint32_t>(mesh.TriangleCount());
+        mTriangleIndices.resize(mesh.TriangleCount());
+        for (uint32_t i = 0; i < mTriangleIndices.size(); i++) {
+            mTriangleIndices[i] = i;
+        }
+
+        TransformTriangles(mesh, transform);
+        Build(false);
+        return false;
+    }
+
+    TransformTriangles(mesh, transform);
+    RefitNode(0, mSettings.Parallel);
+    mSahCost = ComputeSahCost();
+
+    if (GetDegradation() > mSettings.RebuildThreshold) {
+        LOG_INFO("BVH degraded by {}x after refit, rebuilding", GetDegradation());
+        Build(false);
+        return false;
+    }
+
+    return true;
+}
+
+void BvhBuilder::BuildLayer(NodeArena& arena, uint32_t nodeIndex, uint32_t depth, TaskGroup* tasks) {
+    if (depth >= mSettings.MaxDepth) {
+        return;
+    }
+
+    BvhNode leftChild;
+    BvhNode rightChild;
+    if (!SplitNode(arena.Nodes[nodeIndex], leftChild, rightChild)) {
+        return;
+    }
+
+    uint32_t childIndex = static_cast<uint32_t>(arena.Nodes.size());
+    arena.Nodes[nodeIndex].ChildIndex = childIndex;
+    arena.Nodes.push_back(leftChild);
+    arena.Nodes.push_back(rightChild);
+
+    // The left subtree is handed to another task when it is large enough,
+    // while the current task keeps going with the right one.
+    if (tasks && leftChild.TriangleCount >= mSettings.ParallelThreshold) {
+        uint32_t subArenaIndex;
+        NodeArena& subArena = CreateArena(subArenaIndex);
+        subArena.Nodes.reserve(2 * static_cast<size_t>(leftChild.TriangleCount) + 1);
+        subArena.Nodes.push_back(leftChild);
+        arena.SubTrees[childIndex] = subArenaIndex;
+
+        tasks->Run([this, &subArena, depth, tasks]() {
+            BuildLayer(subArena, 0, depth + 1, tasks);
+        });
+    } else {
+        BuildLayer(arena, childIndex, depth + 1, tasks);
+    }
+
+    BuildLayer(arena, childIndex + 1, depth + 1, tasks);
+}
+
+void BvhBuilder::BuildSpatialLayer(uint32_t nodeIndex, std::vector<TriangleReference>& references,
+                                   uint32_t depth, uint32_t& budget, float rootArea,
+                                   std::vector<uint32_t>& primitives) {
+    BvhNode node;
+    for (const auto& reference : references) {
+        Grow(node, reference.Bounds);
+    }
+    node.TriangleIndex = static_cast<uint32_t>(primitives.size());
+    node.TriangleCount = static_cast<uint32_t>(references.size());
+    mBvh[nodeIndex] = node;
+
+    auto makeLeaf = [&]() {
+        for (const auto& reference : references) {
+            primitives.push_back(reference.Triangle);
+        }
+    };
+
+    const float nodeArea = SurfaceArea(node);
+    if (depth >= mSettings.MaxDepth || references.size() <= std::max(mSettings.MaxLeafSize, 1u) ||
+        nodeArea <= 0.0f) {
+        makeLeaf();
+        return;
+    }
+
+    const uint32_t binCount = std::max(mSettings.BinCount, 2u);
+    SplitCandidate objectSplit = FindObjectSplit(references, binCount);
+
+    // Spatial splits only pay off where the object split leaves children that
+    // overlap, which is where long triangles straddle the split plane.
+    SplitCandidate spatialSplit;
+    if (budget > 0 && objectSplit.Cost < FLT_MAX &&
+        SurfaceArea(Intersect(objectSplit.Left, objectSplit.Right)) > mSettings.SpatialSplitOverlap * rootArea) {
+        spatialSplit = FindSpatialSplit(references, mTriangles, node, binCount);
+    }
+
+    bool spatial = spatialSplit.Cost < objectSplit.Cost;
+    float bestCost = std::min(objectSplit.Cost, spatialSplit.Cost);
+    float splitCost = mSettings.TraversalCost + mSettings.IntersectionCost * bestCost / nodeArea;
+    float leafCost = mSettings.IntersectionCost * node.TriangleCount;
+    if (bestCost == FLT_MAX || splitCost >= leafCost) {
+        makeLeaf();
+        return;
+    }
+
+    std::vector<TriangleReference> leftReferences;
+    std::vector<TriangleReference> rightReferences;
+    const int axis = spatial ? spatialSplit.Axis : objectSplit.Axis;
+    const float pos = spatial ? spatialSplit.Pos : objectSplit.Pos;
+    for (const auto& reference : references) {
+        if (!spatial) {
+            float centre = (reference.Bounds.Min[axis] + reference.Bounds.Max[axis]) * 0.5f;
+            (centre < pos ? leftReferences : rightReferences).push_back(reference);
+        } else if (reference.Bounds.Max[axis] <= pos) {
+            leftReferences.push_back(reference);
+        } else if (reference.Bounds.Min[axis] >= pos) {
+            rightReferences.push_back(reference);
+        } else if (budget > 0) {
+            TriangleReference left{ {}, reference.Triangle };
+            TriangleReference right{ {}, reference.Triangle };
+            SplitReference(mTriangles[reference.Triangle], reference.Bounds, axis, pos, left.Bounds, right.Bounds);
+
+            bool hasLeft = left.Bounds.Min.x <= left.Bounds.Max.x;
+            bool hasRight = right.Bounds.Min.x <= right.Bounds.Max.x;
+            if (hasLeft) {
+                leftReferences.push_back(left);
+            }
+            if (hasRight) {
+                rightReferences.push_back(right);
+            }
+            if (hasLeft && hasRight) {
+                budget--;
+            }
+        } else {
+            // Out of budget, the reference goes whole to the side of its centre.
+            float centre = (reference.Bounds.Min[axis] + reference.Bounds.Max[axis]) * 0.5f;
+            (centre < pos ? leftReferences : rightReferences).push_back(reference);
+        }
+    }
+
+    if (leftReferences.empty() || rightReferences.empty()) {
+        makeLeaf();
+        return;
+    }
+
+    references.clear();
+    references.shrink_to_fit();
+
+    uint32_t childIndex = static_cast<uint32_t>(mBvh.size());
+    mBvh[nodeIndex].ChildIndex = childIndex;
+    mBvh.emplace_back();
+    mBvh.emplace_back();
+
+    BuildSpatialLayer(childIndex, leftReferences, depth + 1, budget, rootArea, primitives);
+    BuildSpatialLayer(childIndex + 1, rightReferences, depth + 1, budget, rootArea, primitives);
+
+    // Duplicated references make the subtree hold more triangles than the
+    // node was created with.
+    mBvh[nodeIndex].TriangleCount = mBvh[childIndex].TriangleCount + mBvh[childIndex + 1].TriangleCount;
+}
+
+void BvhBuilder::Flatten(const NodeArena& arena, uint32_t nodeIndex, uint32_t bvhIndex) {
+    auto subTree = arena.SubTrees.find(nodeIndex);
+    if (subTree != arena.SubTrees.end()) {
+        Flatten(*mArenas[subTree->second], 0, bvhIndex);
+        return;
+    }
+
+    const BvhNode& node = arena.Nodes[nodeIndex];
+    mBvh[bvhIndex] = node;
+    if (node.ChildIndex == 0) {
+        return;
+    }
+
+    uint32_t childIndex = static_cast<uint32_t>(mBvh.size());
+    mBvh[bvhIndex].ChildIndex = childIndex;
+    mBvh.emplace_back();
+    mBvh.emplace_back();
+
+    Flatten(arena, node.ChildIndex, childIndex);
+    Flatten(arena, node.ChildIndex + 1, childIndex + 1);
+}
+
+void BvhBuilder::RefitNode(uint32_t nodeIndex, bool parallel) {
+    BvhNode& node = mBvh[nodeIndex];
+    node.Min = glm::vec3(FLT_MAX);
+    node.Max = glm::vec3(-FLT_MAX);
+
+    if (node.ChildIndex == 0) {
+        for (uint32_t i = node.TriangleIndex; i < node.TriangleIndex + node.TriangleCount; i++) {
+            if (mHasTriangles) {
+                Grow(node, mTriangles[i]);
+            } else {
+                Grow(node, mPrimitiveBounds[i]);
+            }
+        }
+        return;
+    }
+
+    // Interior nodes keep the triangle count of their subtree, which tells
+    // whether refitting the left child is worth a separate task.
+    if (parallel && node.TriangleCount >= mSettings.ParallelThreshold) {
+        TaskGroup tasks;
+        tasks.Run([this, &node]() { RefitNode(node.ChildIndex, true); });
+        RefitNode(node.ChildIndex + 1, true);
+        tasks.Wait();
+    } else {
+        RefitNode(node.ChildIndex, parallel);
+        RefitNode(node.ChildIndex + 1, parallel);
+    }
+
+    const BvhNode& left = mBvh[node.ChildIndex];
+    const BvhNode& right = mBvh[node.ChildIndex + 1];
+    node.Min = glm::min(left.Min, right.Min);
+    node.Max = glm::max(left.Max, right.Max);
+}
+
+void BvhBuilder::RotateTreelets() {
+    if (mBvh.empty()) {
+        return;
+    }
+
+    // Nodes are visited bottom up and a rotation only moves subtrees below
+    // the visited node, so the depth of a slot stays valid for as long as it
+    // is read: until the parent of the slot has been visited.
+    std::vector<uint32_t> depths(mBvh.size(), 1);
+    for (size_t i = 0; i < mBvh.size(); i++) {
+        if (mBvh[i].ChildIndex != 0) {
+            depths[mBvh[i].ChildIndex] = depths[i] + 1;
+            depths[mBvh[i].ChildIndex + 1] = depths[i] + 1;
+        }
+    }
+
+    std::vector<uint32_t> heights(mBvh.size(), 1);
+    auto height = [&](uint32_t index) {
+        const BvhNode& node = mBvh[index];
+        return node.ChildIndex == 0 ? 1u
+            : 1 + std::max(heights[node.ChildIndex], heights[node.ChildIndex + 1]);
+    };
+
+    // Each internal node forms a treelet with its children and grandchildren:
+    // swapping a child with one of its nephews keeps the leaves untouched but
+    // can shrink the box of the other child.
+    for (size_t i = mBvh.size(); i-- > 0;) {
+        const uint32_t childIndex = mBvh[i].ChildIndex;
+        if (childIndex == 0) {
+            continue;
+        }
+
+        float bestGain = 0.0f;
+        uint32_t bestSibling = 0;
+        uint32_t bestNephew = 0;
+        for (uint32_t side = 0; side < 2; side++) {
+            uint32_t sibling = childIndex + side;
+            uint32_t other = childIndex + 1 - side;
+            const BvhNode& otherNode = mBvh[other];
+            if (otherNode.ChildIndex == 0) {
+                continue;
+            }
+
+            for (uint32_t n = 0; n < 2; n++) {
+                uint32_t nephew = otherNode.ChildIndex + n;
+                const BvhNode& kept = mBvh[otherNode.ChildIndex + 1 - n];
+
+                BvhNode rotated;
+                rotated.Min = glm::min(kept.Min, mBvh[sibling].Min);
+                rotated.Max = glm::max(kept.Max, mBvh[sibling].Max);
+
+                uint32_t rotatedHeight = 1 + std::max(heights[sibling], heights[otherNode.ChildIndex + 1 - n]);
+                if (depths[other] + rotatedHeight - 1 > mSettings.MaxDepth) {
+                    continue;
+                }
+
+                float gain = SurfaceArea(otherNode) - SurfaceArea(rotated);
+                if (gain > bestGain) {
+                    bestGain = gain;
+                    bestSibling = sibling;
+                    bestNephew = nephew;
+                }
+            }
+        }
+
+        if (bestGain <= 0.0f) {
+            heights[i] = height(static_cast<uint32_t>(i));
+            continue;
+        }
+
+        std::swap(mBvh[bestSibling], mBvh[bestNephew]);
+        std::swap(heights[bestSibling], heights[bestNephew]);
+
+        uint32_t other = bestSibling == childIndex ? childIndex + 1 : childIndex;
+        BvhNode& otherNode = mBvh[other];
+        otherNode.Min = glm::min(mBvh[otherNode.ChildIndex].Min, mBvh[otherNode.ChildIndex + 1].Min);
+        otherNode.Max = glm::max(mBvh[otherNode.ChildIndex].Max, mBvh[otherNode.ChildIndex + 1].Max);
+        otherNode.TriangleCount = mBvh[otherNode.ChildIndex].TriangleCount + mBvh[otherNode.ChildIndex + 1].TriangleCount;
+        heights[other] = height(other);
+        heights[i] = height(static_cast<uint32_t>(i));
+    }
+
+    // A rotated sibling keeps pointing to its children, which may now be
+    // stored before it.
+    Reflatten();
+}
+
+void BvhBuilder::Reflatten() {
+    // Same layout as Flatten: the two children of a node are appended when
+    // the node is visited, and the left subtree is laid out before the right
+    // one.
+    std::vector<BvhNode> bvh;
+    bvh.reserve(mBvh.size());
+    bvh.push_back(mBvh[0]);
+
+    // Old and new index of nodes whose children have not been placed yet.
+    std::vector<std::pair<uint32_t, uint32_t>> stack{ { 0, 0 } };
+    while (!stack.empty()) {
+        auto [oldIndex, newIndex] = stack.back();
+        stack.pop_back();
+
+        uint32_t oldChildIndex = mBvh[oldIndex].ChildIndex;
+        if (oldChildIndex == 0) {
+            continue;
+        }
+
+        uint32_t newChildIndex = static_cast<uint32_t>(bvh.size());
+        bvh[newIndex].ChildIndex = newChildIndex;
+        bvh.push_back(mBvh[oldChildIndex]);
+        bvh.push_back(mBvh[oldChildIndex + 1]);
+        stack.emplace_back(oldChildIndex + 1, newChildIndex + 1);
+        stack.emplace_back(oldChildIndex, newChildIndex);
+    }
+
+    mBvh = std::move(bvh);
+}
+
+float BvhBuilder::ComputeSahCost() const {
+    if (mBvh.empty()) {
+        return 0.0f;
+    }
+
+    float rootArea = SurfaceArea(mBvh[0]);
+    if (rootArea <= 0.0f) {
+        return 0.0f;
+    }
+
+    float cost = 0.0f;
+    for (const auto& node : mBvh) {
+        float area = SurfaceArea(node) / rootArea;
+        if (node.ChildIndex == 0) {
+            cost += mSettings.IntersectionCost * node.TriangleCount * area;
+        } else {
+            cost += mSettings.TraversalCost * area;
+        }
+    }
+
+    return cost;
+}
+
+uint32_t BvhBuilder::ComputeDepth() const {
+    if (mBvh.empty()) {
+        return 0;
+    }
+
+    // Children are always stored after their parent.
+    std::vector<uint32_t> depths(mBvh.size(), 1);
+    uint32_t depth = 1;
+    for (size_t i = 0; i < mBvh.size(); i++) {
+        depth = std::max(depth, depths[i]);
+        if (mBvh[i].ChildIndex != 0) {
+            depths[mBvh[i].ChildIndex] = depths[i] + 1;
+            depths[mBvh[i].ChildIndex + 1] = depths[i] + 1;
+        }
+    }
+
+    return depth;
 }
 
 void BvhBuilder::PrintStats() {
@@ -118,10 +1138,13 @@ void BvhBuilder::PrintStats() {
         }
     }
 
-    avgTriangles /= nonEmpty;
+    avgTriangles /= std::max(nonEmpty, 1u);
 
-    LOG_INFO("Built BVH with depth: {}, total nodes: {}, leaves: {}, avg triangles per leaf (not empty): {}, max triangles in a leaf: {}",
-        mMaxDepth, mBvh.size(), leavesCount, avgTriangles, maxTriangles);
+    const char* splitMethods[] = { "midpoint", "SAH", "LBVH", "SBVH" };
+    LOG_INFO("Built {} BVH with depth: {}, total nodes: {}, leaves: {}, avg triangles per leaf (not empty): {}, max triangles in a leaf: {}, duplicated references: {}, SAH cost: {}",
+        splitMethods[static_cast<int>(mSettings.SplitMethod)],
+        mDepth, mBvh.size(), leavesCount, avgTriangles, maxTriangles,
+        mTriangleIndices.size() - mSourceTriangleCount, mSahCost);
 }
 
 void BvhBuilder::ExportToCSV(const std::string& filepath) const {
@@ -135,4 +1158,80 @@ void BvhBuilder::ExportToCSV(const std::string& filepath) const {
              << node.TriangleCount << "\n";
     }
     file.close();
+}
+
+TlasBuilder::TlasBuilder(std::vector<BvhNode> instanceBounds)
+    : mInstanceBounds(std::move(instanceBounds)) {
+    mInstanceOrder.resize(mInstanceBounds.size());
+    for (uint32_t i = 0; i < mInstanceOrder.size(); i++) {
+        mInstanceOrder[i] = i;
+    }
+}
+
+void TlasBuilder::Build() {
+    mBvh.clear();
+    mBvh.reserve(std::max<size_t>(2 * mInstanceBounds.size(), 1));
+
+    // An empty scene still gets an empty leaf so the shader has a root.
+    BvhNode& root = mBvh.emplace_back();
+    root.TriangleCount = static_cast<uint32_t>(mInstanceBounds.size());
+    mDepth = 0;
+    BuildLayer(0, 1);
+}
+
+void TlasBuilder::BuildLayer(uint32_t nodeIndex, uint32_t depth) {
+    BvhNode node = mBvh[nodeIndex];
+    mDepth = std::max(mDepth, depth);
+
+    glm::vec3 centroidMin{ FLT_MAX };
+    glm::vec3 centroidMax{ -FLT_MAX };
+    for (uint32_t i = node.TriangleIndex; i < node.TriangleIndex + node.TriangleCount; i++) {
+        const BvhNode& bounds = mInstanceBounds[mInstanceOrder[i]];
+        node.Min = glm::min(node.Min, bounds.Min);
+        node.Max = glm::max(node.Max, bounds.Max);
+
+        glm::vec3 centre = (bounds.Min + bounds.Max) * 0.5f;
+        centroidMin = glm::min(centroidMin, centre);
+        centroidMax = glm::max(centroidMax, centre);
+    }
+    mBvh[nodeIndex] = node;
+
+    if (node.TriangleCount <= 1) {
+        return;
+    }
+
+    // Instances are few, an object median split along the widest centroid
+    // axis is good enough and always separates them.
+    glm::vec3 extents = centroidMax - centroidMin;
+    int axis = 0;
+    if (extents.y > extents[axis]) {
+        axis = 1;
+    }
+    if (extents.z > extents[axis]) {
+        axis = 2;
+    }
+
+    auto first = mInstanceOrder.begin() + node.TriangleIndex;
+    auto last = first + node.TriangleCount;
+    auto middle = first + node.TriangleCount / 2;
+    std::nth_element(first, middle, last, [this, axis](uint32_t a, uint32_t b) {
+        return mInstanceBounds[a].Min[axis] + mInstanceBounds[a].Max[axis] <
+            mInstanceBounds[b].Min[axis] + mInstanceBounds[b].Max[axis];
+    });
+
+    BvhNode leftChild;
+    leftChild.TriangleIndex = node.TriangleIndex;
+    leftChild.TriangleCount = node.TriangleCount / 2;
+
+    BvhNode rightChild;
+    rightChild.TriangleIndex = node.TriangleIndex + leftChild.TriangleCount;
+    rightChild.TriangleCount = node.TriangleCount - leftChild.TriangleCount;
+
+    uint32_t childIndex = static_cast<uint32_t>(mBvh.size());
+    mBvh[nodeIndex].ChildIndex = childIndex;
+    mBvh.push_back(leftChild);
+    mBvh.push_back(rightChild);
+
+    BuildLayer(childIndex, depth + 1);
+    BuildLayer(childIndex + 1, depth + 1);
 }
\ No newline at end of file
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <glm/glm.hpp>
 
 #include "Core/AssetManager.h"
 #include "Core/Model.h"
 
+class TaskGroup;
+
 struct BvhNode {
     alignas(16) glm::vec3 Min{ FLT_MAX };
     alignas(16) glm::vec3 Max{ -FLT_MAX };
@@ -13,11 +18,197 @@ struct BvhNode {
     uint32_t TriangleCount{ 0 };
 };
 
+float SurfaceArea(const BvhNode& node);
+
+enum class BvhSplitMethod {
+    Midpoint,
+    BinnedSah,
+    Lbvh,
+    Sbvh
+};
+
+enum class BvhNodeOrder {
+    Build,
+    DepthFirst,
+    VanEmdeBoas
+};
+
+/**
+ * Layout of the triangles uploaded to the GPU. Edges stores the first vertex
+ * and both edges, so the intersection test skips two subtractions. Woop
+ * stores the affine transform that maps the triangle to the unit triangle,
+ * which replaces the cross products of the test with a few dot products.
+ * Indexed stores no triangles at all, the test fetches the vertices through
+ * the index buffer from a packed position stream, which shares the vertices
+ * between triangles instead of copying them into each.
+ */
+enum class TriangleFormat {
+    Vertices,
+    Edges,
+    Woop,
+    Indexed
+};
+
+struct BvhBuildSettings {
+    BvhSplitMethod SplitMethod{ BvhSplitMethod::BinnedSah };
+    /**
+     * Number of centroid bins evaluated per axis by the binned SAH split.
+     */
+    uint32_t BinCount{ 16 };
+    /**
+     * Relative costs used by the surface area heuristic, both for choosing
+     * splits and for the reported tree cost.
+     */
+    float TraversalCost{ 1.0f };
+    float IntersectionCost{ 1.0f };
+    /**
+     * Length of the Morton codes used by the LBVH builder, either 30 or 63
+     * bits. Longer codes separate more triangles in very dense meshes.
+     */
+    uint32_t MortonCodeBits{ 30 };
+    /**
+     * Extra triangle references the SBVH may create through spatial splits,
+     * as a fraction of the triangle count.
+     */
+    float SpatialSplitBudget{ 0.3f };
+    /**
+     * Spatial splits are only evaluated for nodes whose object split children
+     * overlap by more than this fraction of the root surface area.
+     */
+    float SpatialSplitOverlap{ 1e-5f };
+    /**
+     * Nodes with at most this many triangles become leaves. Larger nodes are
+     * still kept as leaves when the SAH finds no split cheaper than the leaf.
+     */
+    uint32_t MaxLeafSize{ 4 };
+    /**
+     * Hard limit on the tree depth that only guards against degenerate input,
+     * the tree normally terminates on MaxLeafSize and the SAH first.
+     */
+    uint32_t MaxDepth{ 64 };
+    /**
+     * Runs a SAH driven restructuring pass over the finished tree, which
+     * mostly benefits the LBVH since its splits ignore the geometry.
+     */
+    bool OptimizeTreelets{ false };
+    /**
+     * Number of children per node in the tree uploaded to the GPU, 2, 4 or 8.
+     * The binary tree is collapsed into this width after the build.
+     */
+    uint32_t NodeWidth{ 4 };
+    /**
+     * Precision of the child boxes in the uploaded nodes. 0 keeps full
+     * floats, 8 or 16 quantize them relative to the parent box, which
+     * shrinks a 4-wide node from 128 to 56 or 80 bytes.
+     */
+    uint32_t NodeQuantizationBits{ 0 };
+    /**
+     * Order of the uploaded nodes in memory. Build keeps the children of a
+     * node next to each other, DepthFirst stores the first child of a node
+     * right after it, and VanEmdeBoas recursively groups subtrees of half
+     * the height so nodes close in the tree are close in memory at every
+     * scale.
+     */
+    BvhNodeOrder NodeOrder{ BvhNodeOrder::DepthFirst };
+    TriangleFormat TriangleEncoding{ TriangleFormat::Indexed };
+    /**
+     * Stores the uploaded vertex positions as 16-bit offsets in the bounds of
+     * their mesh and the normals octahedral encoded in 32 bits, which shrinks
+     * a vertex from 24 to 10 bytes. The mesh trees are then built over the
+     * quantized positions, so their boxes enclose the triangles the shader
+     * decodes.
+     */
+    bool QuantizeVertices{ false };
+    /**
+     * Refit keeps the topology until the SAH cost grows past this factor of
+     * the cost measured after the last full build, then rebuilds the tree.
+     */
+    float RebuildThreshold{ 1.5f };
+    /**
+     * When enabled, subtrees with at least ParallelThreshold triangles are
+     * built as separate tasks on the global thread pool.
+     */
+    bool Parallel{ true };
+    uint32_t ParallelThreshold{ 4096 };
+};
+
+/**
+ * Box of a single primitive. The builder partitions indices into an array of
+ * these instead of moving the primitives themselves.
+ */
+struct PrimitiveBounds {
+    glm::vec3 Min;
+    glm::vec3 Max;
+};
+
+/**
+ * Triangle referenced by the SBVH, with its box clipped by the spatial splits
+ * above it.
+ */
+struct TriangleReference {
+    BvhNode Bounds;
+    uint32_t Triangle;
+};
+
 class BvhBuilder {
 public:
-    BvhBuilder(const Model& model, uint32_t maxDepth);
+    /**
+     * @brief Creates a builder over the triangles of a mesh.
+     *
+     * @param mesh The mesh to build the tree for.
+     * @param settings Build settings.
+     * @param transform Transform baked into the triangles, identity for an
+     * object space tree.
+     */
+    BvhBuilder(const Mesh& mesh, const BvhBuildSettings& settings = {},
+               const glm::mat4& transform = glm::mat4(1.0f));
+    BvhBuilder(const Model& model, const BvhBuildSettings& settings = {});
+    /**
+     * @brief Creates a builder over primitives only known by their boxes,
+     * such as spheres.
+     *
+     * Leaves reference ranges of GetTriangleIndices(), so the primitives
+     * should be uploaded in that order. The SBVH falls back to the binned
+     * SAH, since spatial splits need the triangles to clip.
+     */
+    explicit BvhBuilder(std::vector<PrimitiveBounds> primitives, const BvhBuildSettings& settings = {});
+    /**
+     * @brief Copies the tree of another builder, so it can be refitted while
+     * the original stays in use.
+     */
+    BvhBuilder(const BvhBuilder& other);
+    BvhBuilder& operator=(const BvhBuilder&) = delete;
 
     void Build(bool printStats = true);
+    /**
+     * @brief Takes over a tree built earlier from the same mesh and settings,
+     * e.g. one loaded from the BvhCache, instead of building it again.
+     *
+     * @param bvh Nodes of the tree.
+     * @param triangles Triangles in the order the leaves reference them.
+     * @param triangleIndices Index in the mesh of each triangle.
+     * @return false, leaving the builder unchanged, if the data does not
+     * describe a tree over the mesh of this builder.
+     */
+    bool Restore(std::vector<BvhNode> bvh, std::vector<Triangle> triangles,
+                 std::vector<uint32_t> triangleIndices);
+    /**
+     * @brief Updates the tree after the model matrix or the vertex positions
+     * of the mesh changed.
+     *
+     * The triangles are transformed again and the bounds are recomputed
+     * bottom-up without changing the topology, which costs O(nodes). If the
+     * tree degraded past BvhBuildSettings::RebuildThreshold a full build is
+     * performed instead.
+     *
+     * @param mesh The mesh the builder was created from.
+     * @param transform Transform baked into the triangles.
+     * @return true if the tree was refitted, false if it was rebuilt.
+     */
+    bool Refit(const Mesh& mesh, const glm::mat4& transform = glm::mat4(1.0f));
+    bool Refit(const Model& model) {
+        return Refit(model.GetMesh(), model.GetModelMatrix());
+    }
 
     [[nodiscard]] const std::vector<BvhNode>& GetBvh() const {
         return mBvh;
@@ -27,15 +218,122 @@ public:
         return mTriangles;
     }
 
+    /**
+     * @brief Returns the index in the source mesh of each triangle returned by
+     * GetTriangles(), or of each primitive when built from boxes.
+     */
+    [[nodiscard]] const std::vector<uint32_t>& GetTriangleIndices() const {
+        return mTriangleIndices;
+    }
+
+    /**
+     * @brief Returns the SAH cost of the last built tree.
+     *
+     * The cost is normalized by the surface area of the root, so trees built
+     * from the same mesh with different settings can be compared directly.
+     */
+    [[nodiscard]] float GetSahCost() const {
+        return mSahCost;
+    }
+
+    /**
+     * @brief Returns the depth of the last built tree, a single leaf has a
+     * depth of 1.
+     */
+    [[nodiscard]] uint32_t GetDepth() const {
+        return mDepth;
+    }
+
+    /**
+     * @brief Returns how much the tree degraded since the last full build,
+     * as the ratio between the current and the initial SAH cost.
+     */
+    [[nodiscard]] float GetDegradation() const {
+        return mBuildSahCost > 0.0f ? mSahCost / mBuildSahCost : 1.0f;
+    }
+
     void ExportToCSV(const std::string& filepath) const;
 
 private:
-    void BuildLayer(BvhNode& parent, uint32_t depth);
+    /**
+     * Node storage owned by a single build task. Subtrees handed over to
+     * another task continue in a different arena, and are spliced back by
+     * Flatten once every task has completed.
+     */
+    struct NodeArena {
+        std::vector<BvhNode> Nodes;
+        std::map<uint32_t, uint32_t> SubTrees;
+    };
+
+    void TransformTriangles(const Mesh& mesh, const glm::mat4& transform);
+    void RemoveDuplicateReferences();
+    NodeArena& CreateArena(uint32_t& arenaIndex);
+    void SortByMortonCode(const BvhNode& root, TaskGroup* tasks);
+    bool SplitNode(const BvhNode& parent, BvhNode& leftChild, BvhNode& rightChild);
+    void BuildLayer(NodeArena& arena, uint32_t nodeIndex, uint32_t depth, TaskGroup* tasks);
+    void BuildSpatialLayer(uint32_t nodeIndex, std::vector<TriangleReference>& references,
+                           uint32_t depth, uint32_t& budget, float rootArea,
+                           std::vector<uint32_t>& primitives);
+    void GatherPrimitives();
+    void Flatten(const NodeArena& arena, uint32_t nodeIndex, uint32_t bvhIndex);
+    void RefitNode(uint32_t nodeIndex, bool parallel);
+    void RotateTreelets();
+    void Reflatten();
+    float ComputeSahCost() const;
+    uint32_t ComputeDepth() const;
     void PrintStats();
 
-    const Model& mModel;
     std::vector<BvhNode> mBvh;
     std::vector<Triangle> mTriangles;
+    std::vector<uint32_t> mTriangleIndices;
+    // Build state: the primitives in the order the splits partitioned them,
+    // and the box of each primitive. Builders without triangles keep the
+    // boxes, in leaf order, once the build is done.
+    std::vector<uint32_t> mPrimitives;
+    std::vector<PrimitiveBounds> mPrimitiveBounds;
+    bool mHasTriangles{ true };
+    std::vector<uint64_t> mMortonCodes;
+    uint32_t mSourceTriangleCount{ 0 };
+
+    std::vector<std::unique_ptr<NodeArena>> mArenas;
+    std::mutex mArenasMutex;
+
+    BvhBuildSettings mSettings;
+    uint32_t mDepth{ 0 };
+    float mSahCost{ 0.0f };
+    float mBuildSahCost{ 0.0f };
+};
+
+/**
+ * @brief Builds the top-level BVH over the world space boxes of the scene
+ * instances.
+ *
+ * Leaves reference a range of GetInstanceOrder() through TriangleIndex and
+ * TriangleCount, so the instances should be uploaded in that order.
+ */
+class TlasBuilder {
+public:
+    explicit TlasBuilder(std::vector<BvhNode> instanceBounds);
+
+    void Build();
+
+    [[nodiscard]] const std::vector<BvhNode>& GetBvh() const {
+        return mBvh;
+    }
+
+    [[nodiscard]] const std::vector<uint32_t>& GetInstanceOrder() const {
+        return mInstanceOrder;
+    }
 
-    uint32_t mMaxDepth;
+    [[nodiscard]] uint32_t GetDepth() const {
+        return mDepth;
+    }
+
+private:
+    void BuildLayer(uint32_t nodeIndex, uint32_t depth);
+
+    std::vector<BvhNode> mInstanceBounds;
+    std::vector<uint32_t> mInstanceOrder;
+    std::vector<BvhNode> mBvh;
+    uint32_t mDepth{ 0 };
 };
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "BvhCache.h"
+
+#include <format>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "Core/Logger.h"
+
+// The header is padded to 16 bytes, so the arrays following it stay aligned
+// in the file.
+struct alignas(16) BvhCacheHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Key;
+    uint32_t NodeSize;
+    uint32_t TriangleSize;
+    uint32_t NodeCount;
+    uint32_t TriangleCount;
+};
+
+static_assert(sizeof(BvhCacheHeader) % 16 == 0);
+
+constexpr uint32_t BVH_CACHE_MAGIC = 0x43485642; // "BVHC"
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+void HashBytes(uint64_t& hash, const void* data, size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+}
+
+template <typename T>
+void HashValue(uint64_t& hash, const T& value) {
+    HashBytes(hash, &value, sizeof(T));
+}
+
+void HashVector(uint64_t& hash, const glm::vec3& vector) {
+    // Only the components are hashed, the padding of the aligned vectors is
+    // left uninitialized.
+    HashValue(hash, vector.x);
+    HashValue(hash, vector.y);
+    HashValue(hash, vector.z);
+}
+
+BvhCache::BvhCache(std::filesystem::path directory)
+    : mDirectory(std::move(directory)) {}
+
+uint64_t BvhCache::ComputeKey(const Mesh& mesh, const BvhBuildSettings& settings) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    HashValue(hash, static_cast<uint64_t>(mesh.TriangleCount()));
+    for (size_t i = 0; i < mesh.TriangleCount(); i++) {
+        Triangle tri = mesh.GetTriangle(i);
+        HashVector(hash, tri.V0);
+        HashVector(hash, tri.V1);
+        HashVector(hash, tri.V2);
+    }
+
+    HashValue(hash, settings.SplitMethod);
+    HashValue(hash, settings.BinCount);
+    HashValue(hash, settings.TraversalCost);
+    HashValue(hash, settings.IntersectionCost);
+    HashValue(hash, settings.MortonCodeBits);
+    HashValue(hash, settings.SpatialSplitBudget);
+    HashValue(hash, settings.SpatialSplitOverlap);
+    HashValue(hash, settings.MaxLeafSize);
+    HashValue(hash, settings.MaxDepth);
+    HashValue(hash, settings.OptimizeTreelets);
+
+    return hash;
+}
+
+bool BvhCache::Load(uint64_t key, BvhBuilder& builder) const {
+    std::filesystem::path path = GetPath(key);
+    std::error_code error;
+    uintmax_t fileSize = std::filesystem::file_size(path, error);
+    std::ifstream file(path, std::ios::binary);
+    if (error || !file || fileSize < sizeof(BvhCacheHeader)) {
+        return false;
+    }
+
+    BvhCacheHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.Magic != BVH_CACHE_MAGIC || header.Version != VERSION || header.Key != key ||
+        header.NodeSize != sizeof(BvhNode) || header.TriangleSize != sizeof(Triangle)) {
+        LOG_INFO("Ignoring outdated BVH cache entry {}", path.string());
+        return false;
+    }
+
+    size_t nodesSize = static_cast<size_t>(header.NodeCount) * sizeof(BvhNode);
+    size_t trianglesSize = static_cast<size_t>(header.TriangleCount) * sizeof(Triangle);
+    size_t indicesSize = static_cast<size_t>(header.TriangleCount) * sizeof(uint32_t);
+    if (fileSize != sizeof(header) + nodesSize + trianglesSize + indicesSize) {
+        LOG_WARNING("Ignoring truncated BVH cache entry {}", path.string());
+        return false;
+    }
+
+    // The arrays are read straight into the vectors the builder takes over,
+    // mapping the file would only add a copy out of the mapping.
+    std::vector<BvhNode> bvh(header.NodeCount);
+    std::vector<Triangle> triangles(header.TriangleCount);
+    std::vector<uint32_t> triangleIndices(header.TriangleCount);
+    file.read(reinterpret_cast<char*>(bvh.data()), nodesSize);
+    file.read(reinterpret_cast<char*>(triangles.data()), trianglesSize);
+    file.read(reinterpret_cast<char*>(triangleIndices.data()), indicesSize);
+    if (!file) {
+        LOG_WARNING("Failed to read BVH cache entry {}", path.string());
+        return false;
+    }
+
+    if (!builder.Restore(std::move(bvh), std::move(triangles), std::move(triangleIndices))) {
+        LOG_WARNING("Ignoring invalid BVH cache entry {}", path.string());
+        return false;
+    }
+
+    LOG_INFO("Loaded BVH with {} nodes from {}", header.NodeCount, path.string());
+    return true;
+}
+
+void BvhCache::Store(uint64_t key, const BvhBuilder& builder) const {
+    std::error_code error;
+    std::filesystem::create_directories(mDirectory, error);
+    if (error) {
+        LOG_WARNING("Failed to create BVH cache directory {}: {}", mDirectory.string(), error.message());
+        return;
+    }
+
+    const auto& bvh = builder.GetBvh();
+    const auto& triangles = builder.GetTriangles();
+    const auto& triangleIndices = builder.GetTriangleIndices();
+
+    BvhCacheHeader header{};
+    header.Magic = BVH_CACHE_MAGIC;
+    header.Version = VERSION;
+    header.Key = key;
+    header.NodeSize = sizeof(BvhNode);
+    header.TriangleSize = sizeof(Triangle);
+    header.NodeCount = static_cast<uint32_t>(bvh.size());
+    header.TriangleCount = static_cast<uint32_t>(triangles.size());
+
+    // The entry is written next to its final location and renamed once it is
+    // complete, so an interrupted run never leaves a truncated entry behind.
+    // Threads storing the same entry each write their own file.
+    std::filesystem::path path = GetPath(key);
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += std::format(".{:x}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(bvh.data()), bvh.size() * sizeof(BvhNode));
+        file.write(reinterpret_cast<const char*>(triangles.data()), triangles.size() * sizeof(Triangle));
+        file.write(reinterpret_cast<const char*>(triangleIndices.data()),
+                   triangleIndices.size() * sizeof(uint32_t));
+        if (!file) {
+            LOG_WARNING("Failed to write BVH cache entry {}", temporaryPath.string());
+            file.close();
+            std::filesystem::remove(temporaryPath, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        LOG_WARNING("Failed to write BVH cache entry {}: {}", path.string(), error.message());
+        std::filesystem::remove(temporaryPath, error);
+    }
+}
+
+std::filesystem::path BvhCache::GetPath(uint64_t key) const {
+    return mDirectory / std::format("{:016x}.bvh", key);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <filesystem>
+
+#include "Core/BvhBuilder.h"
+
+/**
+ * @brief Stores built object space BVHs on disk so they can be reused by the
+ * next run instead of being built again.
+ *
+ * Every tree is written to its own file named after a key that hashes the
+ * mesh triangles together with the settings that affect the binary tree. A
+ * file starts with a header holding a magic number, the format version, the
+ * key and the array sizes, followed by the nodes, the reordered triangles and
+ * their indices in the mesh. The arrays are read straight into the vectors
+ * the builder takes over. Files are ignored when the header does not match,
+ * so stale entries are simply rebuilt and overwritten.
+ */
+class BvhCache {
+public:
+    // Bumped whenever the builder output changes for the same key, e.g. the
+    // order of the triangles in the leaves.
+    static constexpr uint32_t VERSION = 2;
+
+    explicit BvhCache(std::filesystem::path directory = "cache/bvh");
+
+    /**
+     * @brief Computes the key of the tree built over the triangles of a mesh.
+     *
+     * The node width and quantization are not part of the key, since they
+     * are applied to the binary tree after it is built.
+     */
+    static uint64_t ComputeKey(const Mesh& mesh, const BvhBuildSettings& settings);
+
+    /**
+     * @brief Restores the tree stored under the given key into a builder
+     * created from the same mesh.
+     *
+     * @return false if there is no valid entry for the key.
+     */
+    bool Load(uint64_t key, BvhBuilder& builder) const;
+
+    /**
+     * @brief Writes the tree of a builder under the given key, replacing any
+     * previous entry. Failures are logged and otherwise ignored.
+     */
+    void Store(uint64_t key, const BvhBuilder& builder) const;
+
+private:
+    [[nodiscard]] std::filesystem::path GetPath(uint64_t key) const;
+
+    std::filesystem::path mDirectory;
+};
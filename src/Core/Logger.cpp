@@ -50,6 +50,7 @@ void Logger::Log(LogLevel level, const char *file, int line,
         break;
     }
 
+    std::lock_guard lock(logger->mMutex);
     auto t = std::time(nullptr);
     auto tm = *std::localtime(&t);
     logger->mLogFile << "[" << std::put_time(&tm, "%d-%m-%Y %H:%M:%S") << "] ["
@@ -2,6 +2,7 @@
 
 #include <format>
 #include <fstream>
+#include <mutex>
 #include <string>
 
 /**
@@ -98,5 +99,6 @@ private:
     ~Logger();
 
     std::ofstream mLogFile;
+    std::mutex mMutex;
     LogLevel mLogLevel;
 };
@@ -0,0 +1,112 @@
+#include "MappedFile.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& filepath) {
+    HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+
+    // The mapping keeps the file referenced, so its handle can be closed.
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        return;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        return;
+    }
+
+    mMapping = mapping;
+    mData = static_cast<const std::byte*>(data);
+    mSize = static_cast<size_t>(size.QuadPart);
+}
+
+void MappedFile::Close() {
+    if (mData) {
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapping);
+    }
+    mData = nullptr;
+    mMapping = nullptr;
+    mSize = 0;
+}
+#else
+MappedFile::MappedFile(const std::string& filepath) {
+    int file = open(filepath.c_str(), O_RDONLY);
+    if (file < 0) {
+        return;
+    }
+
+    struct stat status{};
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        close(file);
+        return;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        return;
+    }
+
+    mData = static_cast<const std::byte*>(data);
+    mSize = static_cast<size_t>(status.st_size);
+}
+
+void MappedFile::Close() {
+    if (mData) {
+        munmap(const_cast<std::byte*>(mData), mSize);
+    }
+    mData = nullptr;
+    mSize = 0;
+}
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : mData(std::exchange(other.mData, nullptr)),
+      mSize(std::exchange(other.mSize, 0))
+#ifdef _WIN32
+    , mMapping(std::exchange(other.mMapping, nullptr))
+#endif
+{}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        Close();
+        mData = std::exchange(other.mData, nullptr);
+        mSize = std::exchange(other.mSize, 0);
+#ifdef _WIN32
+        mMapping = std::exchange(other.mMapping, nullptr);
+#endif
+    }
+    return *this;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Read-only memory mapping of a whole file.
+ *
+ * The pages are only read from disk when they are first accessed, so large
+ * files can be validated through a small header before the rest is touched.
+ * The mapping is released when the object is destroyed.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& filepath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    /**
+     * @brief Returns false if the file could not be opened or is empty.
+     */
+    [[nodiscard]] bool IsOpen() const {
+        return mData != nullptr;
+    }
+
+    [[nodiscard]] const std::byte* Data() const {
+        return mData;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return mSize;
+    }
+
+private:
+    void Close();
+
+    const std::byte* mData{ nullptr };
+    size_t mSize{ 0 };
+#ifdef _WIN32
+    void* mMapping{ nullptr };
+#endif
+};
@@ -0,0 +1,132 @@
+#include "MeshCache.h"
+
+#include "Core/AssetManager.h"
+#include "Core/Logger.h"
+#include "Core/ThreadPool.h"
+
+MeshCache::MeshCache(size_t budgetBytes)
+    : mBudgetBytes(budgetBytes) {}
+
+MeshCache& MeshCache::Global() {
+    static MeshCache cache;
+    return cache;
+}
+
+std::shared_ptr<Mesh> MeshCache::Get(const std::string& path) {
+    std::shared_ptr<std::promise<std::shared_ptr<Mesh>>> load;
+    std::shared_future<std::shared_ptr<Mesh>> mesh = Acquire(path, load);
+    if (load) {
+        Load(path, *load);
+    }
+    return mesh.get();
+}
+
+std::shared_future<std::shared_ptr<Mesh>> MeshCache::GetAsync(const std::string& path) {
+    std::shared_ptr<std::promise<std::shared_ptr<Mesh>>> load;
+    std::shared_future<std::shared_ptr<Mesh>> mesh = Acquire(path, load);
+    if (load) {
+        ThreadPool::Global().Enqueue([this, path, load]() { Load(path, *load); });
+    }
+    return mesh;
+}
+
+void MeshCache::SetBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBudgetBytes = budgetBytes;
+    Evict(mBudgetBytes);
+}
+
+void MeshCache::Trim() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    Evict(0);
+}
+
+MeshCache::Stats MeshCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return { mHits, mMisses, mEvictions, mEntries.size(), mBytes, mBudgetBytes };
+}
+
+std::shared_future<std::shared_ptr<Mesh>> MeshCache::Acquire(
+    const std::string& path, std::shared_ptr<std::promise<std::shared_ptr<Mesh>>>& load) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto it = mEntries.find(path);
+    if (it != mEntries.end()) {
+        mHits++;
+        mLru.splice(mLru.begin(), mLru, it->second.LruPosition);
+        if (it->second.Pending.valid()) {
+            return it->second.Pending;
+        }
+
+        std::promise<std::shared_ptr<Mesh>> loaded;
+        loaded.set_value(it->second.Loaded);
+        return loaded.get_future().share();
+    }
+
+    mMisses++;
+    load = std::make_shared<std::promise<std::shared_ptr<Mesh>>>();
+    mLru.push_front(path);
+
+    Entry& entry = mEntries[path];
+    entry.Pending = load->get_future().share();
+    entry.LruPosition = mLru.begin();
+    return entry.Pending;
+}
+
+void MeshCache::Load(const std::string& path, std::promise<std::shared_ptr<Mesh>>& load) {
+    // The waiting requests get the exception instead of waiting forever.
+    std::shared_ptr<Mesh> mesh;
+    std::exception_ptr error;
+    try {
+        mesh = AssetManager::LoadMesh(path);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Complete(path, std::move(mesh), error, load);
+}
+
+void MeshCache::Complete(const std::string& path, std::shared_ptr<Mesh> mesh, std::exception_ptr error,
+                         std::promise<std::shared_ptr<Mesh>>& load) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Loading entries are never evicted, so the entry is still there.
+    auto it = mEntries.find(path);
+    if (mesh) {
+        it->second.Loaded = mesh;
+        it->second.Bytes = mesh->SizeBytes();
+        it->second.Pending = {};
+        mBytes += it->second.Bytes;
+    } else {
+        // Failures are not kept, the next request tries again.
+        mLru.erase(it->second.LruPosition);
+        mEntries.erase(it);
+    }
+
+    // Requests that joined the load keep its result alive through their
+    // futures until they took their own reference.
+    if (error) {
+        load.set_exception(error);
+    } else {
+        load.set_value(std::move(mesh));
+    }
+    Evict(mBudgetBytes);
+}
+
+void MeshCache::Evict(size_t budgetBytes) {
+    for (auto it = mLru.end(); it != mLru.begin() && mBytes > budgetBytes;) {
+        --it;
+        auto entry = mEntries.find(*it);
+
+        // The only reference left to an unused mesh is the cache's own.
+        const auto& mesh = entry->second.Loaded;
+        if (!mesh || mesh.use_count() > 1) {
+            continue;
+        }
+
+        LOG_DEBUG("Releasing mesh {} ({} bytes)", *it, entry->second.Bytes);
+        mBytes -= entry->second.Bytes;
+        mEvictions++;
+        mEntries.erase(entry);
+        it = mLru.erase(it);
+    }
+}
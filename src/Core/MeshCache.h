@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Core/Model.h"
+
+/**
+ * @brief Keeps loaded meshes by path so every model using a file shares one
+ * mesh.
+ *
+ * The cache holds up to a byte budget of meshes. Once it grows past the
+ * budget, the least recently requested meshes that nothing outside the cache
+ * references any more are released. Meshes still used by a model are never
+ * released, so the budget can be exceeded while they are alive.
+ *
+ * All functions can be called from any thread. A path requested again while
+ * it is still loading waits for that load instead of starting another one.
+ */
+class MeshCache {
+public:
+    struct Stats {
+        // Requests served by a loaded or loading mesh.
+        uint64_t Hits;
+        // Requests that started a load.
+        uint64_t Misses;
+        uint64_t Evictions;
+        size_t MeshCount;
+        size_t Bytes;
+        size_t BudgetBytes;
+    };
+
+    explicit MeshCache(size_t budgetBytes = size_t(1) << 30);
+
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    /**
+     * @brief Gets the application wide cache, which models load their meshes
+     * through.
+     */
+    static MeshCache& Global();
+
+    /**
+     * @brief Gets the mesh of a file, loading it on the calling thread if it
+     * is neither loaded nor loading.
+     *
+     * @return The mesh, or nullptr if the file could not be loaded. An
+     * exception thrown by the import is rethrown.
+     */
+    std::shared_ptr<Mesh> Get(const std::string& path);
+    /**
+     * @brief Gets the mesh of a file, loading it on the global thread pool if
+     * it is neither loaded nor loading.
+     *
+     * An exception thrown by the import is stored in the future of every
+     * request waiting for the load. The cache has to outlive the loads it
+     * starts.
+     */
+    std::shared_future<std::shared_ptr<Mesh>> GetAsync(const std::string& path);
+
+    /**
+     * @brief Sets the byte budget and releases meshes until the cache fits in
+     * it, as far as they are unreferenced.
+     */
+    void SetBudget(size_t budgetBytes);
+    /**
+     * @brief Releases every unreferenced mesh.
+     */
+    void Trim();
+
+    [[nodiscard]] Stats GetStats() const;
+
+private:
+    struct Entry {
+        // Set once the load completed.
+        std::shared_ptr<Mesh> Loaded;
+        // Valid while the mesh loads, reset once it is stored.
+        std::shared_future<std::shared_ptr<Mesh>> Pending;
+        size_t Bytes{ 0 };
+        std::list<std::string>::iterator LruPosition;
+    };
+
+    /**
+     * @brief Looks up a path and registers a load for it if it is unknown.
+     *
+     * @param load Set to the promise of the new load when the caller has to
+     * Load the mesh.
+     * @return Future of the mesh.
+     */
+    std::shared_future<std::shared_ptr<Mesh>> Acquire(const std::string& path,
+                                                      std::shared_ptr<std::promise<std::shared_ptr<Mesh>>>& load);
+    void Load(const std::string& path, std::promise<std::shared_ptr<Mesh>>& load);
+    void Complete(const std::string& path, std::shared_ptr<Mesh> mesh, std::exception_ptr error,
+                  std::promise<std::shared_ptr<Mesh>>& load);
+    // Called with the mutex locked.
+    void Evict(size_t budgetBytes);
+
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries;
+    // Paths from the most to the least recently requested.
+    std::list<std::string> mLru;
+    size_t mBytes{ 0 };
+    size_t mBudgetBytes;
+    uint64_t mHits{ 0 };
+    uint64_t mMisses{ 0 };
+    uint64_t mEvictions{ 0 };
+};
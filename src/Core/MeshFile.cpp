@@ -0,0 +1,144 @@
+#include "MeshFile.h"
+
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "Core/Logger.h"
+#include "Core/MappedFile.h"
+
+// Padded to 16 bytes like the BVH cache header. The streams following it only
+// need 4 byte alignment, which their sizes keep.
+struct alignas(16) MeshFileHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t SourceSize;
+    int64_t SourceTime;
+    uint32_t VertexCount;
+    uint32_t IndexCount;
+    uint32_t SubMeshCount;
+};
+
+static_assert(sizeof(MeshFileHeader) % 16 == 0);
+static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec2) == 8,
+              "Mesh files store tightly packed vectors");
+
+constexpr uint32_t MESH_FILE_MAGIC = 0x4853454d; // "MESH"
+
+bool GetSourceStamp(const std::filesystem::path& sourcePath, uint64_t& size, int64_t& time) {
+    std::error_code error;
+    size = std::filesystem::file_size(sourcePath, error);
+    if (error) {
+        return false;
+    }
+
+    auto writeTime = std::filesystem::last_write_time(sourcePath, error);
+    if (error) {
+        return false;
+    }
+    time = static_cast<int64_t>(writeTime.time_since_epoch().count());
+    return true;
+}
+
+std::shared_ptr<Mesh> MeshFile::Read(const std::filesystem::path& path,
+                                     const std::filesystem::path& sourcePath) {
+    auto file = std::make_shared<MappedFile>(path.string());
+    if (!file->IsOpen() || file->Size() < sizeof(MeshFileHeader)) {
+        return nullptr;
+    }
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!GetSourceStamp(sourcePath, sourceSize, sourceTime)) {
+        return nullptr;
+    }
+
+    MeshFileHeader header;
+    std::memcpy(&header, file->Data(), sizeof(header));
+    if (header.Magic != MESH_FILE_MAGIC || header.Version != VERSION ||
+        header.SourceSize != sourceSize || header.SourceTime != sourceTime) {
+        LOG_INFO("Ignoring outdated mesh file {}", path.string());
+        return nullptr;
+    }
+
+    size_t positionsSize = static_cast<size_t>(header.VertexCount) * sizeof(glm::vec3);
+    size_t normalsSize = positionsSize;
+    size_t uvsSize = static_cast<size_t>(header.VertexCount) * sizeof(glm::vec2);
+    size_t indicesSize = static_cast<size_t>(header.IndexCount) * sizeof(uint32_t);
+    size_t subMeshesSize = static_cast<size_t>(header.SubMeshCount) * sizeof(SubMesh);
+    if (file->Size() != sizeof(header) + positionsSize + normalsSize + uvsSize + indicesSize + subMeshesSize) {
+        LOG_WARNING("Ignoring truncated mesh file {}", path.string());
+        return nullptr;
+    }
+
+    const std::byte* data = file->Data() + sizeof(header);
+    auto positions = reinterpret_cast<const glm::vec3*>(data);
+    auto normals = reinterpret_cast<const glm::vec3*>(data + positionsSize);
+    auto uvs = reinterpret_cast<const glm::vec2*>(data + positionsSize + normalsSize);
+    auto indices = reinterpret_cast<const uint32_t*>(data + positionsSize + normalsSize + uvsSize);
+    auto subMeshes = reinterpret_cast<const SubMesh*>(data + positionsSize + normalsSize + uvsSize + indicesSize);
+
+    // An index out of range would read past the mapping later on.
+    for (uint32_t i = 0; i < header.IndexCount; i++) {
+        if (indices[i] >= header.VertexCount) {
+            LOG_WARNING("Ignoring invalid mesh file {}", path.string());
+            return nullptr;
+        }
+    }
+
+    LOG_INFO("Loaded mesh with {} triangles from {}", header.IndexCount / 3, path.string());
+    return std::make_shared<Mesh>(
+        file, std::span(positions, header.VertexCount), std::span(normals, header.VertexCount),
+        std::span(uvs, header.VertexCount), std::span(indices, header.IndexCount),
+        std::span(subMeshes, header.SubMeshCount));
+}
+
+void MeshFile::Write(const std::filesystem::path& path, const std::filesystem::path& sourcePath,
+                     const Mesh& mesh) {
+    MeshFileHeader header{};
+    header.Magic = MESH_FILE_MAGIC;
+    header.Version = VERSION;
+    header.VertexCount = static_cast<uint32_t>(mesh.Positions().size());
+    header.IndexCount = static_cast<uint32_t>(mesh.Indices().size());
+    header.SubMeshCount = static_cast<uint32_t>(mesh.SubMeshes().size());
+    if (!GetSourceStamp(sourcePath, header.SourceSize, header.SourceTime)) {
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    if (error) {
+        LOG_WARNING("Failed to create mesh file directory {}: {}", path.parent_path().string(),
+                    error.message());
+        return;
+    }
+
+    // Written next to its final location and renamed once complete, so an
+    // interrupted run never leaves a truncated file behind. Threads writing
+    // the same file each write their own copy.
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += std::format(".{:x}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(mesh.Positions().data()), mesh.Positions().size_bytes());
+        file.write(reinterpret_cast<const char*>(mesh.Normals().data()), mesh.Normals().size_bytes());
+        file.write(reinterpret_cast<const char*>(mesh.Uvs().data()), mesh.Uvs().size_bytes());
+        file.write(reinterpret_cast<const char*>(mesh.Indices().data()), mesh.Indices().size_bytes());
+        file.write(reinterpret_cast<const char*>(mesh.SubMeshes().data()), mesh.SubMeshes().size_bytes());
+        if (!file) {
+            LOG_WARNING("Failed to write mesh file {}", temporaryPath.string());
+            file.close();
+            std::filesystem::remove(temporaryPath, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        LOG_WARNING("Failed to write mesh file {}: {}", path.string(), error.message());
+        std::filesystem::remove(temporaryPath, error);
+    }
+}
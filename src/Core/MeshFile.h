@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+
+#include "Core/Model.h"
+
+/**
+ * @brief Native binary mesh format, written after importing a file so later
+ * runs can skip Assimp.
+ *
+ * A file starts with a header holding a magic number, the format version,
+ * the size and modification time of the source file it was imported from and
+ * the stream sizes. It is followed by the positions, normals, texture
+ * coordinates, indices and the submesh table, stored exactly as Mesh exposes
+ * them. Files are read through a memory mapping the mesh points into, and are
+ * ignored when the header does not match the source file.
+ */
+class MeshFile {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    /**
+     * @brief Maps the mesh file imported from a source file.
+     *
+     * @return nullptr if the file is missing, invalid or older than its
+     * source.
+     */
+    static std::shared_ptr<Mesh> Read(const std::filesystem::path& path,
+                                      const std::filesystem::path& sourcePath);
+
+    /**
+     * @brief Writes a mesh imported from a source file, replacing any
+     * previous file. Failures are logged and otherwise ignored.
+     */
+    static void Write(const std::filesystem::path& path, const std::filesystem::path& sourcePath,
+                      const Mesh& mesh);
+};
@@ -1,20 +1,29 @@
 #include "Model.h"
 
-#include <map>
+#include "Core/MappedFile.h"
+#include "Core/MeshCache.h"
 
-#include "Core/AssetManager.h"
+Mesh::Mesh(std::vector<glm::vec3> positions, std::vector<glm::vec3> normals,
+           std::vector<glm::vec2> uvs, std::vector<uint32_t> indices,
+           std::vector<SubMesh> subMeshes)
+    : mPositionData(std::move(positions)), mNormalData(std::move(normals)),
+      mUvData(std::move(uvs)), mIndexData(std::move(indices)),
+      mSubMeshData(std::move(subMeshes)), mPositions(mPositionData),
+      mNormals(mNormalData), mUvs(mUvData), mIndices(mIndexData),
+      mSubMeshes(mSubMeshData) {}
 
-static std::map<std::string, std::shared_ptr<Mesh>> sMeshCache;
+Mesh::Mesh(std::shared_ptr<const MappedFile> file, std::span<const glm::vec3> positions,
+           std::span<const glm::vec3> normals, std::span<const glm::vec2> uvs,
+           std::span<const uint32_t> indices, std::span<const SubMesh> subMeshes)
+    : mFile(std::move(file)), mPositions(positions), mNormals(normals), mUvs(uvs),
+      mIndices(indices), mSubMeshes(subMeshes) {}
 
 Model::Model(const std::string& path, const Material& material, const glm::mat4& modelMatrix)
-    : mMaterial(material), mModelMatrix(modelMatrix) {
-    if (sMeshCache.contains(path)) {
-        mMesh = sMeshCache[path];
-        return;
-    }
-
-    mMesh = AssetManager::LoadMesh(path);
-    sMeshCache[path] = mMesh;
+    : mMesh(MeshCache::Global().Get(path)), mMaterial(material), mModelMatrix(modelMatrix) {
+    mUpdate = modelMatrix != glm::mat4(1.0f);
+}
 
+Model::Model(std::shared_ptr<Mesh> mesh, const Material& material, const glm::mat4& modelMatrix)
+    : mMesh(std::move(mesh)), mMaterial(material), mModelMatrix(modelMatrix) {
     mUpdate = modelMatrix != glm::mat4(1.0f);
 }
\ No newline at end of file
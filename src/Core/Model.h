@@ -3,39 +3,89 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <span>
 
 #include <glm/glm.hpp>
 
 #include "App/UBOs.h"
 
-class AssetManager;
+class MappedFile;
 
+/**
+ * @brief Range of the index buffer holding the triangles of one of the meshes
+ * a file was imported from.
+ */
+struct SubMesh {
+    uint32_t FirstIndex;
+    uint32_t IndexCount;
+};
+
+/**
+ * @brief Indexed triangle mesh.
+ *
+ * The vertex streams either belong to the mesh, after an import, or point
+ * into a mapped mesh file the mesh keeps open, in which case they are never
+ * copied.
+ */
 class Mesh {
 public:
-    [[nodiscard]] const std::vector<Triangle>& Triangles() const {
-        return mTriangles;
-    }
-    [[nodiscard]] std::vector<Triangle>& Triangles() {
-        return mTriangles;
-    }
+    Mesh() = default;
+    Mesh(std::vector<glm::vec3> positions, std::vector<glm::vec3> normals,
+         std::vector<glm::vec2> uvs, std::vector<uint32_t> indices,
+         std::vector<SubMesh> subMeshes);
+    Mesh(std::shared_ptr<const MappedFile> file, std::span<const glm::vec3> positions,
+         std::span<const glm::vec3> normals, std::span<const glm::vec2> uvs,
+         std::span<const uint32_t> indices, std::span<const SubMesh> subMeshes);
 
-    [[nodiscard]] const std::vector<Mesh>& SubMeshes() const {
-        return subMeshes;
+    // The views point into the vectors, which keep their storage when moved.
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    Mesh(Mesh&&) = default;
+    Mesh& operator=(Mesh&&) = default;
+
+    [[nodiscard]] std::span<const glm::vec3> Positions() const { return mPositions; }
+    [[nodiscard]] std::span<const glm::vec3> Normals() const { return mNormals; }
+    [[nodiscard]] std::span<const glm::vec2> Uvs() const { return mUvs; }
+    [[nodiscard]] std::span<const uint32_t> Indices() const { return mIndices; }
+    [[nodiscard]] std::span<const SubMesh> SubMeshes() const { return mSubMeshes; }
+
+    [[nodiscard]] size_t TriangleCount() const { return mIndices.size() / 3; }
+    // Memory taken by the vertex streams, owned or mapped.
+    [[nodiscard]] size_t SizeBytes() const {
+        return mPositions.size_bytes() + mNormals.size_bytes() + mUvs.size_bytes() +
+               mIndices.size_bytes() + mSubMeshes.size_bytes();
     }
-    [[nodiscard]] std::vector<Mesh>& SubMeshes() {
-        return subMeshes;
+    [[nodiscard]] Triangle GetTriangle(size_t index) const {
+        Triangle tri;
+        tri.V0 = mPositions[mIndices[3 * index]];
+        tri.V1 = mPositions[mIndices[3 * index + 1]];
+        tri.V2 = mPositions[mIndices[3 * index + 2]];
+        return tri;
     }
 
 private:
-    std::vector<Triangle> mTriangles;
-    std::vector<Mesh> subMeshes;
-    
-    friend class AssetManager;
+    std::vector<glm::vec3> mPositionData;
+    std::vector<glm::vec3> mNormalData;
+    std::vector<glm::vec2> mUvData;
+    std::vector<uint32_t> mIndexData;
+    std::vector<SubMesh> mSubMeshData;
+    std::shared_ptr<const MappedFile> mFile;
+
+    std::span<const glm::vec3> mPositions;
+    std::span<const glm::vec3> mNormals;
+    std::span<const glm::vec2> mUvs;
+    std::span<const uint32_t> mIndices;
+    std::span<const SubMesh> mSubMeshes;
 };
 
 class Model {
 public:
     Model(const std::string& path, const Material& material, const glm::mat4& modelMatrix = glm::mat4(1.0f));
+    /**
+     * @brief Constructs a model instancing an already loaded mesh, such as
+     * one loaded with MeshCache::GetAsync.
+     */
+    Model(std::shared_ptr<Mesh> mesh, const Material& material, const glm::mat4& modelMatrix = glm::mat4(1.0f));
 
     bool GetUpdate() const { return mUpdate; }
     void SetUpdate(bool update) { mUpdate = update; }
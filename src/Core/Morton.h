@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * @brief Spreads the lowest 21 bits of a value so that two zero bits separate
+ * each of them.
+ */
+inline uint64_t ExpandMortonBits(uint64_t value) {
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffff;
+    value = (value | value << 16) & 0x1f0000ff0000ff;
+    value = (value | value << 8) & 0x100f00f00f00f00f;
+    value = (value | value << 4) & 0x10c30c30c30c30c3;
+    value = (value | value << 2) & 0x1249249249249249;
+    return value;
+}
+
+/**
+ * @brief Computes the Morton code of a point normalized in the unit cube.
+ *
+ * @param position Point with coordinates in [0, 1].
+ * @param bitsPerAxis Bits used for each axis, at most 21 (63 bit codes).
+ * @return Interleaved code with the x axis in the most significant bit.
+ */
+inline uint64_t MortonCode(const glm::vec3& position, uint32_t bitsPerAxis) {
+    float scale = static_cast<float>(1u << bitsPerAxis);
+    uint64_t maxValue = (1ull << bitsPerAxis) - 1;
+
+    uint64_t code = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float scaled = std::max(position[axis] * scale, 0.0f);
+        uint64_t quantized = std::min(static_cast<uint64_t>(scaled), maxValue);
+        code |= ExpandMortonBits(quantized) << (2 - axis);
+    }
+
+    return code;
+}
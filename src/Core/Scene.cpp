@@ -1,6 +1,105 @@
 #include "Scene.h"
 
-static constexpr uint32_t MAX_BVH_DEPTH = 16;
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#include "Core/BvhBenchmark.h"
+#include "Core/ThreadPool.h"
+
+GpuTriangle EncodeTriangle(const Triangle& triangle, TriangleFormat format) {
+    GpuTriangle encoded{};
+    if (format == TriangleFormat::Vertices) {
+        encoded.Rows[0] = glm::vec4(triangle.V0, 0.0f);
+        encoded.Rows[1] = glm::vec4(triangle.V1, 0.0f);
+        encoded.Rows[2] = glm::vec4(triangle.V2, 0.0f);
+        return encoded;
+    }
+
+    if (format == TriangleFormat::Edges) {
+        encoded.Rows[0] = glm::vec4(triangle.V0, 0.0f);
+        encoded.Rows[1] = glm::vec4(triangle.V1 - triangle.V0, 0.0f);
+        encoded.Rows[2] = glm::vec4(triangle.V2 - triangle.V0, 0.0f);
+        return encoded;
+    }
+
+    // The rows of the inverse of [E1 E2 N] map a point relative to V0 to its
+    // barycentric coordinates and its distance from the plane in units of N.
+    // Doubles keep thin triangles from losing their inverse.
+    glm::dvec3 v0(triangle.V0);
+    glm::dvec3 edge1 = glm::dvec3(triangle.V1) - v0;
+    glm::dvec3 edge2 = glm::dvec3(triangle.V2) - v0;
+    glm::dvec3 normal = glm::cross(edge1, edge2);
+    double determinant = glm::dot(normal, normal);
+    if (determinant <= 0.0) {
+        // Pushes every hit to an infinite distance, so it is never taken.
+        encoded.Rows[0] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return encoded;
+    }
+
+    glm::dvec3 rowU = glm::cross(edge2, normal) / determinant;
+    glm::dvec3 rowV = glm::cross(normal, edge1) / determinant;
+    glm::dvec3 rowW = normal / determinant;
+
+    encoded.Rows[0] = glm::vec4(glm::vec3(rowW), static_cast<float>(glm::dot(rowW, v0)));
+    encoded.Rows[1] = glm::vec4(glm::vec3(rowU), static_cast<float>(-glm::dot(rowU, v0)));
+    encoded.Rows[2] = glm::vec4(glm::vec3(rowV), static_cast<float>(-glm::dot(rowV, v0)));
+    return encoded;
+}
+
+// Largest quantized position along an axis.
+constexpr float POSITION_STEPS = 65535.0f;
+
+void ComputePositionGrid(std::span<const glm::vec3> positions, glm::vec3& origin, glm::vec3& scale) {
+    if (positions.empty()) {
+        origin = glm::vec3(0.0f);
+        scale = glm::vec3(0.0f);
+        return;
+    }
+
+    glm::vec3 min(FLT_MAX);
+    glm::vec3 max(-FLT_MAX);
+    for (const auto& position : positions) {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+    origin = min;
+    scale = (max - min) / POSITION_STEPS;
+}
+
+glm::uvec3 QuantizePosition(const glm::vec3& position, const glm::vec3& origin, const glm::vec3& scale) {
+    glm::uvec3 quantized(0);
+    for (int axis = 0; axis < 3; axis++) {
+        // Flat meshes have no extent along an axis, every vertex sits at 0.
+        if (scale[axis] > 0.0f) {
+            float steps = std::round((position[axis] - origin[axis]) / scale[axis]);
+            quantized[axis] = static_cast<uint32_t>(std::clamp(steps, 0.0f, POSITION_STEPS));
+        }
+    }
+    return quantized;
+}
+
+uint32_t EncodeOctahedral(const glm::vec3& normal) {
+    float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length == 0.0f) {
+        return 0;
+    }
+
+    // Projects the normal onto the octahedron and folds its lower half over
+    // the upper one, so the unit square covers every direction.
+    glm::vec3 projected = normal / length;
+    glm::vec2 encoded(projected.x, projected.y);
+    if (projected.z < 0.0f) {
+        encoded = (1.0f - glm::abs(glm::vec2(projected.y, projected.x))) *
+                  glm::vec2(projected.x >= 0.0f ? 1.0f : -1.0f, projected.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    // Laid out like packSnorm2x16, so the shader reads it with unpackSnorm2x16.
+    auto x = static_cast<int16_t>(std::round(std::clamp(encoded.x, -1.0f, 1.0f) * 32767.0f));
+    auto y = static_cast<int16_t>(std::round(std::clamp(encoded.y, -1.0f, 1.0f) * 32767.0f));
+    return static_cast<uint32_t>(static_cast<uint16_t>(x)) | static_cast<uint32_t>(static_cast<uint16_t>(y)) << 16;
+}
 
 Scene::Scene(const std::shared_ptr<VulkanManager>& vulkanManager,
              const std::shared_ptr<Shader>& shader,
@@ -14,26 +113,70 @@ Scene::Scene(const std::shared_ptr<VulkanManager>& vulkanManager,
     mVertexPipeline = std::make_unique<ComputePipeline>(mVulkanManager, vertexShader);
 }
 
+Scene::~Scene() {
+    // The worker still references the scene.
+    if (mBuildDone.valid()) {
+        mBuildDone.wait();
+    }
+}
+
 void Scene::AddModel(Model model) {
-    auto bvhBuilder = BvhBuilder(model, MAX_BVH_DEPTH);
-    bvhBuilder.Build();
+    uint32_t blasIndex = GetOrAddBlas(model.GetMesh());
+    AppendModel(std::move(model), blasIndex);
+
+    mModifiedModels = true;
+    mRebuild = true;
+}
+
+void Scene::AddModels(std::vector<Model> models) {
+    mMaterials.reserve(mMaterials.size() + models.size());
+    mModelUBOs.reserve(mModelUBOs.size() + models.size());
+    mModelBlasIndices.reserve(mModelBlasIndices.size() + models.size());
+    mModels.reserve(mModels.size() + models.size());
+    for (auto& model : models) {
+        uint32_t blasIndex = GetOrAddBlas(model.GetMesh());
+        AppendModel(std::move(model), blasIndex);
+    }
 
+    mModifiedModels = true;
+    mRebuild = true;
+}
+
+void Scene::AppendModel(Model model, uint32_t blasIndex) {
+    // The offsets into the mesh arrays are filled in by the rebuild.
     ModelUBO modelUBO;
-    modelUBO.TriangleOffset = mNumTriangles;
-    modelUBO.BvhOffset = mBvhNodes.size();
+    modelUBO.WorldToObject = glm::inverse(model.GetModelMatrix());
+    modelUBO.TriangleOffset = 0;
+    modelUBO.BvhOffset = 0;
     modelUBO.MaterialIndex = mMaterials.size();
 
-    mBvhNodes.insert(mBvhNodes.end(), bvhBuilder.GetBvh().begin(), bvhBuilder.GetBvh().end());
+    mDirtyMaterials.Mark(mMaterials.size());
     mMaterials.push_back(model.GetMaterial());
     mModelUBOs.push_back(modelUBO);
+    mModelBlasIndices.push_back(blasIndex);
+    model.SetUpdate(false);
     mModels.push_back(std::move(model));
+}
 
-    for (const auto& model : mModels) {
-        const auto& mesh = bvhBuilder.GetTriangles();
-        mTriangles.insert(mTriangles.end(), mesh.begin(), mesh.end());
-        mNumTriangles += mesh.size();
+void Scene::UpdateMeshPositions(const Mesh& mesh, std::vector<glm::vec3> positions) {
+    auto it = mBlasIndices.find(&mesh);
+    if (it == mBlasIndices.end() || positions.size() != mesh.Positions().size()) {
+        LOG_WARNING("Cannot move the vertices of a mesh the scene does not contain");
+        return;
     }
 
+    auto normals = mesh.Normals();
+    auto uvs = mesh.Uvs();
+    auto indices = mesh.Indices();
+    auto subMeshes = mesh.SubMeshes();
+    mDeformedMeshes.resize(mMeshes.size());
+    mDeformedMeshes[it->second] = std::make_shared<const Mesh>(
+        std::move(positions), std::vector<glm::vec3>(normals.begin(), normals.end()),
+        std::vector<glm::vec2>(uvs.begin(), uvs.end()), std::vector<uint32_t>(indices.begin(), indices.end()),
+        std::vector<SubMesh>(subMeshes.begin(), subMeshes.end()));
+    mDeformedBlases.push_back(it->second);
+
+    mModifiedModels = true;
     mRebuild = true;
 }
 
@@ -41,90 +184,597 @@ void Scene::AddSphere(Sphere sphere, const Material material) {
     sphere.materialIndex = mMaterials.size();
 
     mSpheres.push_back(std::move(sphere));
+    mDirtyMaterials.Mark(mMaterials.size());
     mMaterials.push_back(std::move(material));
 
+    mModifiedSpheres = true;
     mRebuild = true;
 }
 
 void Scene::AddPlane(Plane plane, const Material material) {
     plane.materialIndex = mMaterials.size();
 
+    mDirtyPlanes.Mark(mPlanes.size());
     mPlanes.push_back(std::move(plane));
+    mDirtyMaterials.Mark(mMaterials.size());
     mMaterials.push_back(std::move(material));
+}
 
-    mRebuild = true;
+bool Scene::Update(const std::shared_ptr<CommandBuffer>& commandBuffer) {
+    mFrame++;
+    RetireBuffers(commandBuffer->Buffers().size());
+
+    bool swapped = false;
+    if (mBuildDone.valid() &&
+        mBuildDone.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        FinishBuild();
+        swapped = true;
+    }
+
+    if (mRebuild && !mBuildDone.valid()) {
+        StartBuild();
+    }
+
+    // There is no previous scene to show on the first frames.
+    if (!mActiveScene.TlasNodes && mBuildDone.valid()) {
+        mBuildDone.wait();
+        FinishBuild();
+        swapped = true;
+    }
+
+    if (mDefragment && !mBuildDone.valid()) {
+        DefragmentBuffers();
+        mDefragment = false;
+    }
+
+    // Only what changed since the last frame is written, in front of the
+    // dispatch reading it.
+    commandBuffer->ExecuteCommand([this](VkCommandBuffer cmdBuffer) {
+        UploadArray(cmdBuffer, mPlanes, mDirtyPlanes, mPlanesBuffer);
+        UploadArray(cmdBuffer, mMaterials, mDirtyMaterials, mMaterialsBuffer);
+    });
+
+    return swapped;
 }
 
 void Scene::Draw(const std::shared_ptr<CommandBuffer>& commandBuffer) {
-    if (mRebuild) {
+    mShader->BindStorageBuffer(*mActiveScene.Spheres, "spheresBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.SphereNodes, "sphereNodesBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mPlanesBuffer, "planesBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mMaterialsBuffer, "materialsBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.BvhNodes, "bvhNodesBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.TlasNodes, "tlasNodesBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.Triangles, "trianglesBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.Indices, "indicesBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.Positions, "positionsBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.Normals, "normalsBuffer", commandBuffer->CurrentBufferIndex());
+    mShader->BindStorageBuffer(*mActiveScene.ModelUBOs, "modelsBuffer", commandBuffer->CurrentBufferIndex());
+}
+
+template <typename T>
+void Scene::UploadArray(VkCommandBuffer commandBuffer, const std::vector<T>& data, DirtyRange& dirty,
+                        std::unique_ptr<StorageBuffer<T>>& buffer) {
+    if (!buffer) {
+        buffer = std::make_unique<StorageBuffer<T>>(mVulkanManager, data.data(), data.size());
+        dirty = {};
+        return;
+    }
+
+    buffer->Resize(data.size());
+    size_t end = std::min(dirty.End, data.size());
+    if (dirty.First < end) {
+        buffer->Update(commandBuffer, data.data() + dirty.First, dirty.First, end - dirty.First);
+    }
+    dirty = {};
+}
+
+void Scene::StartBuild() {
+    mBuild = std::make_unique<SceneBuild>();
+    SceneBuild& build = *mBuild;
+    build.Settings = mBvhSettings;
+    // Meshes the rebuild reuses keep their node layout, which differs from
+    // the settings after a fallback to full precision nodes. Changed
+    // settings rebuild every mesh anyway.
+    if (!mRebuildBvhs) {
+        build.Settings.NodeQuantizationBits = mActiveBvhSettings.NodeQuantizationBits;
+    }
+    // The first rebuild creates every buffer, even for an empty scene.
+    build.RebuildModels = mModifiedModels || mRebuildBvhs || !mActiveScene.Triangles;
+    build.RebuildTlas = build.RebuildModels || mModifiedTransforms;
+    build.RebuildSpheres = mModifiedSpheres || !mActiveScene.Spheres;
+    build.StackSizes = mStackSizes;
+
+    if (build.RebuildTlas) {
+        // Transform edits never touch the mesh BVHs, only the instance
+        // transforms and the top level tree over them.
         for (uint32_t i = 0; i < mModels.size(); i++) {
-            if (!mModels[i].GetUpdate()) {
-                continue;
+            if (mModels[i].GetUpdate()) {
+                mModelUBOs[i].WorldToObject = glm::inverse(mModels[i].GetModelMatrix());
+                mModels[i].SetUpdate(false);
             }
+        }
 
-            auto bvhBuilder = BvhBuilder(mModels[i], MAX_BVH_DEPTH);
-            bvhBuilder.Build();
-
-            auto& modelUBO = mModelUBOs[i];
-            const auto& mesh = bvhBuilder.GetTriangles();
-            const auto& bvh = bvhBuilder.GetBvh();
-            mTriangles.insert(mTriangles.begin() + modelUBO.TriangleOffset, mesh.begin(), mesh.end());
-            mBvhNodes.insert(mBvhNodes.begin() + modelUBO.BvhOffset, bvh.begin(), bvh.end());
-        }
-    
-        mSpheresBuffer = std::make_unique<StorageBuffer<Sphere>>(
-            mVulkanManager, mSpheres.data(), mSpheres.size());
-        mPlanesBuffer = std::make_unique<StorageBuffer<Plane>>(
-            mVulkanManager, mPlanes.data(), mPlanes.size());
-        mTrianglesBuffer = std::make_unique<StorageBuffer<Triangle>>(
-            mVulkanManager, mTriangles.data(), mTriangles.size());
-        mBvhNodesBuffer = std::make_unique<StorageBuffer<BvhNode>>(
-            mVulkanManager, mBvhNodes.data(), mBvhNodes.size());
-        mModelUBOsBuffer = std::make_unique<StorageBuffer<ModelUBO>>(
-            mVulkanManager, mModelUBOs.data(), mModelUBOs.size());
-        mMaterialsBuffer = std::make_unique<StorageBuffer<Material>>(
-            mVulkanManager, mMaterials.data(), mMaterials.size());
-
-        mRebuild = false;
-    }
-
-    mShader->BindStorageBuffer(*mSpheresBuffer, "spheresBuffer", commandBuffer->CurrentBufferIndex());
-    mShader->BindStorageBuffer(*mPlanesBuffer, "planesBuffer", commandBuffer->CurrentBufferIndex());
-    mShader->BindStorageBuffer(*mMaterialsBuffer, "materialsBuffer", commandBuffer->CurrentBufferIndex());
-    mShader->BindStorageBuffer(*mBvhNodesBuffer, "bvhNodesBuffer", commandBuffer->CurrentBufferIndex());
-    mShader->BindStorageBuffer(*mTrianglesBuffer, "trianglesBuffer", commandBuffer->CurrentBufferIndex());
-    mShader->BindStorageBuffer(*mModelUBOsBuffer, "modelsBuffer", commandBuffer->CurrentBufferIndex());
+        build.Blases = mBlases;
+        build.Blases.resize(mMeshes.size());
+        build.RefitBlases.resize(mMeshes.size());
+        if (mRebuildBvhs) {
+            std::fill(build.Blases.begin(), build.Blases.end(), nullptr);
+        } else {
+            for (uint32_t blasIndex : mDeformedBlases) {
+                if (build.Blases[blasIndex]) {
+                    build.RefitBlases[blasIndex] = std::exchange(build.Blases[blasIndex], nullptr);
+                }
+            }
+        }
+        mDeformedBlases.clear();
+        build.Meshes = mMeshes;
+        build.DeformedMeshes = mDeformedMeshes;
+        build.DeformedMeshes.resize(mMeshes.size());
+        build.ModelBlasIndices = mModelBlasIndices;
+        build.ModelUBOs = mModelUBOs;
+        build.ModelMatrices.reserve(mModels.size());
+        for (const auto& model : mModels) {
+            build.ModelMatrices.push_back(model.GetModelMatrix());
+        }
+    }
+    if (build.RebuildSpheres) {
+        build.Spheres = mSpheres;
+    }
+
+    mModifiedModels = false;
+    mModifiedTransforms = false;
+    mModifiedSpheres = false;
+    mRebuildBvhs = false;
+    mRebuild = false;
+
+    mBuildDone = ThreadPool::Global().Submit([this, &build]() { ExecuteBuild(build); });
+}
+
+void Scene::FinishBuild() {
+    mBuildDone = {};
+    std::unique_ptr<SceneBuild> build = std::move(mBuild);
+
+    RetiredScene retired;
+    retired.Frame = mFrame;
+    if (build->RebuildModels) {
+        mBlases = std::move(build->Blases);
+        retired.Buffers.Triangles = std::exchange(mActiveScene.Triangles, std::move(build->Buffers.Triangles));
+        retired.Buffers.Indices = std::exchange(mActiveScene.Indices, std::move(build->Buffers.Indices));
+        retired.Buffers.Positions = std::exchange(mActiveScene.Positions, std::move(build->Buffers.Positions));
+        retired.Buffers.Normals = std::exchange(mActiveScene.Normals, std::move(build->Buffers.Normals));
+        retired.Buffers.BvhNodes = std::exchange(mActiveScene.BvhNodes, std::move(build->Buffers.BvhNodes));
+        mStackSizes.Blas = build->StackSizes.Blas;
+        mActiveBvhSettings = build->Settings;
+
+        // Models added during the rebuild get theirs from the next one.
+        for (uint32_t i = 0; i < build->ModelUBOs.size(); i++) {
+            mModelUBOs[i].TriangleOffset = build->ModelUBOs[i].TriangleOffset;
+            mModelUBOs[i].BvhOffset = build->ModelUBOs[i].BvhOffset;
+            mModelUBOs[i].PositionOrigin = build->ModelUBOs[i].PositionOrigin;
+            mModelUBOs[i].PositionScale = build->ModelUBOs[i].PositionScale;
+        }
+    }
+    if (build->RebuildTlas) {
+        retired.Buffers.TlasNodes = std::exchange(mActiveScene.TlasNodes, std::move(build->Buffers.TlasNodes));
+        retired.Buffers.ModelUBOs = std::exchange(mActiveScene.ModelUBOs, std::move(build->Buffers.ModelUBOs));
+        mStackSizes.Tlas = build->StackSizes.Tlas;
+    }
+    if (build->RebuildSpheres) {
+        retired.Buffers.Spheres = std::exchange(mActiveScene.Spheres, std::move(build->Buffers.Spheres));
+        retired.Buffers.SphereNodes = std::exchange(mActiveScene.SphereNodes, std::move(build->Buffers.SphereNodes));
+        mStackSizes.Spheres = build->StackSizes.Spheres;
+    }
+
+    mRetiredScenes.push_back(std::move(retired));
+}
+
+void Scene::RetireBuffers(uint64_t framesInFlight) {
+    // No fence is tracked per retired scene, this relies on how frames are
+    // submitted: Update runs once per frame, after Surface::WaitNextImage
+    // waited for the fence of the frame that used the same slot before, and
+    // the slots, one per command buffer, are used round robin. Starting frame
+    // n therefore means frame n - framesInFlight completed. The retired
+    // buffers were last bound by the frame before the one that swapped them
+    // out, so they are unused once framesInFlight more frames started. Other
+    // submissions never read them: SubmitCommand waits for its own fence, and
+    // staging ring copies only write to the buffers before they are
+    // swapped in.
+    std::erase_if(mRetiredScenes, [&](const RetiredScene& retired) {
+        return mFrame - retired.Frame > framesInFlight;
+    });
+}
+
+void Scene::DefragmentBuffers() {
+    MemoryAllocator& allocator = mVulkanManager->Allocator();
+    if (allocator.BeginDefragmentation() > 0) {
+        // Buffers of retired scenes are left where they are, they are freed
+        // after a few frames anyway.
+        auto relocate = [](auto& buffer) {
+            if (buffer) {
+                buffer->Relocate();
+            }
+        };
+        relocate(mPlanesBuffer);
+        relocate(mMaterialsBuffer);
+        relocate(mActiveScene.Spheres);
+        relocate(mActiveScene.SphereNodes);
+        relocate(mActiveScene.Triangles);
+        relocate(mActiveScene.Indices);
+        relocate(mActiveScene.Positions);
+        relocate(mActiveScene.Normals);
+        relocate(mActiveScene.BvhNodes);
+        relocate(mActiveScene.TlasNodes);
+        relocate(mActiveScene.ModelUBOs);
+    }
+    allocator.EndDefragmentation();
+
+    MemoryAllocator::Stats stats = allocator.GetStats();
+    LOG_INFO("GPU memory after defragmentation: {} blocks, {} of {} MiB in use", stats.BlockCount,
+             stats.UsedBytes >> 20, stats.ReservedBytes >> 20);
+}
+
+void Scene::ExecuteBuild(SceneBuild& build) const {
+    if (build.RebuildModels) {
+        BuildBlases(build);
+
+        BlasArrays arrays;
+        GatherBlasData(build, arrays);
+
+        build.Buffers.Triangles = std::make_unique<StorageBuffer<GpuTriangle>>(
+            mVulkanManager, arrays.Triangles.data(), arrays.Triangles.size());
+        build.Buffers.Indices = std::make_unique<StorageBuffer<uint32_t>>(
+            mVulkanManager, arrays.Indices.data(), arrays.Indices.size());
+        build.Buffers.Positions = std::make_unique<StorageBuffer<uint32_t>>(
+            mVulkanManager, arrays.Positions.data(), arrays.Positions.size());
+        build.Buffers.Normals = std::make_unique<StorageBuffer<uint32_t>>(
+            mVulkanManager, arrays.Normals.data(), arrays.Normals.size());
+        build.Buffers.BvhNodes = std::make_unique<StorageBuffer<uint32_t>>(
+            mVulkanManager, arrays.BvhNodes.data(), arrays.BvhNodes.size());
+    }
+
+    if (build.RebuildTlas) {
+        BuildTlas(build);
+    }
+
+    if (build.RebuildSpheres) {
+        BuildSphereBvh(build);
+    }
+}
+
+std::map<std::string, std::string> Scene::GetShaderDefines(const BvhBuildSettings& settings) {
+    return {
+        { "BVH_WIDTH", std::to_string(settings.NodeWidth) },
+        { "BVH_QUANTIZATION_BITS", std::to_string(settings.NodeQuantizationBits) },
+        { "TRIANGLE_FORMAT", std::to_string(static_cast<int>(settings.TriangleEncoding)) },
+        { "QUANTIZED_VERTICES", settings.QuantizeVertices ? "1" : "0" }
+    };
+}
+
+void Scene::SetBvhSettings(const BvhBuildSettings& settings) {
+    mBvhSettings = settings;
+
+    mRebuildBvhs = true;
+    mModifiedSpheres = true;
+    mRebuild = true;
+}
+
+uint32_t Scene::GetOrAddBlas(const Mesh& mesh) {
+    auto it = mBlasIndices.find(&mesh);
+    if (it != mBlasIndices.end()) {
+        return it->second;
+    }
+
+    // The BVH itself is built by the next rebuild, together with every other
+    // new mesh.
+    uint32_t blasIndex = static_cast<uint32_t>(mMeshes.size());
+    mMeshes.push_back(&mesh);
+    mBlasIndices.emplace(&mesh, blasIndex);
+
+    return blasIndex;
+}
+
+void Scene::BuildBlas(Blas& blas, const BvhBuildSettings& settings, const Blas* previous) const {
+    // Quantizing moves the vertices by up to half a step, so the tree is
+    // built over the positions the shader decodes instead.
+    const Mesh* source = blas.Source;
+    std::unique_ptr<Mesh> quantizedMesh;
+    if (settings.QuantizeVertices) {
+        auto positions = blas.Source->Positions();
+        ComputePositionGrid(positions, blas.PositionOrigin, blas.PositionScale);
+
+        std::vector<glm::vec3> decodedPositions(positions.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            glm::uvec3 quantized = QuantizePosition(positions[i], blas.PositionOrigin, blas.PositionScale);
+            decodedPositions[i] = blas.PositionOrigin + glm::vec3(quantized) * blas.PositionScale;
+        }
+
+        auto indices = blas.Source->Indices();
+        quantizedMesh = std::make_unique<Mesh>(std::move(decodedPositions), std::vector<glm::vec3>(),
+                                               std::vector<glm::vec2>(),
+                                               std::vector<uint32_t>(indices.begin(), indices.end()),
+                                               std::vector<SubMesh>());
+        source = quantizedMesh.get();
+    }
+
+    // The previous tree of a deformed mesh is copied, since the scene being
+    // rendered still uses it, and refitted over the new positions.
+    if (previous && previous->Builder) {
+        blas.Builder = std::make_unique<BvhBuilder>(*previous->Builder);
+        if (!blas.Builder->Refit(*source)) {
+            LOG_DEBUG("Refitting a mesh with {} triangles degraded its BVH, rebuilt it", source->TriangleCount());
+        }
+    } else {
+        blas.Builder = std::make_unique<BvhBuilder>(*source, settings);
+
+        uint64_t key = BvhCache::ComputeKey(*source, settings);
+        if (!mBvhCache.Load(key, *blas.Builder)) {
+            blas.Builder->Build();
+            mBvhCache.Store(key, *blas.Builder);
+        }
+    }
+
+    blas.Nodes = std::make_unique<WideBvh>(blas.Builder->GetBvh(), settings.NodeWidth,
+                                           settings.NodeQuantizationBits);
+    blas.Nodes->Reorder(settings.NodeOrder);
+}
+
+void Scene::BuildBlases(SceneBuild& build) const {
+    // Each mesh is built by its own task and the builders spawn their own
+    // nested tasks, so a batch of small meshes and a single large one both
+    // keep the pool busy.
+    TaskGroup group;
+    for (size_t i = 0; i < build.Blases.size(); i++) {
+        if (build.Blases[i]) {
+            continue;
+        }
+
+        group.Run([this, &build, i]() {
+            auto blas = std::make_shared<Blas>();
+            blas->Deformed = build.DeformedMeshes[i];
+            blas->Source = blas->Deformed ? blas->Deformed.get() : build.Meshes[i];
+            BuildBlas(*blas, build.Settings, build.RefitBlases[i].get());
+            build.Blases[i] = std::move(blas);
+        });
+    }
+    group.Wait();
+
+    // The shader reads every mesh with the same node layout, so a single mesh
+    // too large for quantized leaves takes the whole scene to full precision.
+    // The binary trees come back from the cache.
+    if (std::any_of(build.Blases.begin(), build.Blases.end(),
+                    [](const auto& blas) { return !blas->Nodes->IsValid(); })) {
+        LOG_WARNING("A mesh has more triangles than quantized BVH leaves can address, "
+                    "falling back to full precision nodes");
+        build.Settings.NodeQuantizationBits = 0;
+        std::fill(build.Blases.begin(), build.Blases.end(), nullptr);
+        BuildBlases(build);
+    }
+}
+
+void Scene::BenchmarkBvhs() const {
+    const char* orderNames[] = { "Build", "Depth first", "Van Emde Boas" };
+
+    for (const auto& blas : mBlases) {
+        LOG_INFO("Benchmarking BVH node orders for a mesh with {} triangles",
+                 blas->Source->TriangleCount());
+
+        BvhBenchmark benchmark(*blas->Builder, mActiveBvhSettings, blas->Source);
+        for (const auto& result : benchmark.Run()) {
+            LOG_INFO("{:>14}: {:8.2f} ms, {:5.2f}x, {:6.1f} nodes per ray, {:8.2f} ms indexed",
+                     orderNames[static_cast<int>(result.Order)], result.Milliseconds,
+                     result.Speedup, result.NodesPerRay, result.IndexedMilliseconds);
+        }
+    }
+}
+
+void Scene::GatherBlasData(SceneBuild& build, BlasArrays& arrays) const {
+    build.StackSizes.Blas = 1;
+    bool indexed = build.Settings.TriangleEncoding == TriangleFormat::Indexed;
+    bool quantized = build.Settings.QuantizeVertices;
+
+    size_t triangleCount = 0;
+    size_t vertexCount = 0;
+    size_t nodeWordCount = 0;
+    for (const auto& blas : build.Blases) {
+        triangleCount += blas->Builder->GetTriangles().size();
+        vertexCount += blas->Source->Positions().size();
+        nodeWordCount += blas->Nodes->GetNodes().size();
+    }
+    if (indexed) {
+        arrays.Positions.reserve(quantized ? (3 * vertexCount + 1) / 2 : 3 * vertexCount);
+    } else {
+        arrays.Triangles.reserve(triangleCount);
+    }
+    arrays.Indices.reserve(3 * triangleCount);
+    arrays.Normals.reserve(quantized ? vertexCount : 3 * vertexCount);
+    arrays.BvhNodes.reserve(nodeWordCount);
+
+    // Quantized coordinates are 16 bits each, packed two to a word across
+    // the meshes.
+    size_t quantizedCoordinates = 0;
+
+    std::vector<uint32_t> triangleOffsets(build.Blases.size());
+    std::vector<uint32_t> bvhOffsets(build.Blases.size());
+    uint32_t firstVertex = 0;
+    for (size_t i = 0; i < build.Blases.size(); i++) {
+        const Blas& blas = *build.Blases[i];
+        const Mesh& mesh = *blas.Source;
+        const auto& bvh = blas.Nodes->GetNodes();
+
+        triangleOffsets[i] = static_cast<uint32_t>(arrays.Indices.size() / 3);
+        bvhOffsets[i] = static_cast<uint32_t>(arrays.BvhNodes.size() / blas.Nodes->GetNodeStride());
+
+        // The BVH may reference a triangle from several leaves, the indices
+        // follow its leaves rather than the mesh.
+        auto meshIndices = mesh.Indices();
+        for (uint32_t triangleIndex : blas.Builder->GetTriangleIndices()) {
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                arrays.Indices.push_back(firstVertex + meshIndices[3 * triangleIndex + corner]);
+            }
+        }
+
+        auto normals = mesh.Normals();
+        if (quantized) {
+            for (const auto& normal : normals) {
+                arrays.Normals.push_back(EncodeOctahedral(normal));
+            }
+        } else {
+            auto words = reinterpret_cast<const uint32_t*>(normals.data());
+            arrays.Normals.insert(arrays.Normals.end(), words, words + 3 * normals.size());
+        }
+
+        auto positions = mesh.Positions();
+        if (indexed && quantized) {
+            arrays.Positions.resize((quantizedCoordinates + 3 * positions.size() + 1) / 2);
+            for (const auto& position : positions) {
+                glm::uvec3 quantizedPosition = QuantizePosition(position, blas.PositionOrigin, blas.PositionScale);
+                for (int axis = 0; axis < 3; axis++, quantizedCoordinates++) {
+                    arrays.Positions[quantizedCoordinates / 2] |=
+                        quantizedPosition[axis] << (16 * (quantizedCoordinates % 2));
+                }
+            }
+        } else if (indexed) {
+            auto words = reinterpret_cast<const uint32_t*>(positions.data());
+            arrays.Positions.insert(arrays.Positions.end(), words, words + 3 * positions.size());
+        } else {
+            for (const auto& triangle : blas.Builder->GetTriangles()) {
+                arrays.Triangles.push_back(EncodeTriangle(triangle, build.Settings.TriangleEncoding));
+            }
+        }
+        firstVertex += static_cast<uint32_t>(positions.size());
+
+        arrays.BvhNodes.insert(arrays.BvhNodes.end(), bvh.begin(), bvh.end());
+
+        // Each level below the root leaves at most Width - 1 siblings behind.
+        uint32_t stackSize = (blas.Nodes->GetWidth() - 1) * blas.Nodes->GetDepth() + 1;
+        build.StackSizes.Blas = std::max(build.StackSizes.Blas, stackSize);
+    }
+
+    for (uint32_t i = 0; i < build.ModelUBOs.size(); i++) {
+        uint32_t blasIndex = build.ModelBlasIndices[i];
+        const Blas& blas = *build.Blases[blasIndex];
+        build.ModelUBOs[i].TriangleOffset = triangleOffsets[blasIndex];
+        build.ModelUBOs[i].BvhOffset = bvhOffsets[blasIndex];
+        build.ModelUBOs[i].PositionOrigin = glm::vec4(blas.PositionOrigin, 0.0f);
+        build.ModelUBOs[i].PositionScale = glm::vec4(blas.PositionScale, 0.0f);
+    }
+}
+
+void Scene::BuildTlas(SceneBuild& build) const {
+    std::vector<BvhNode> instanceBounds(build.ModelUBOs.size());
+    for (uint32_t i = 0; i < build.ModelUBOs.size(); i++) {
+        const BvhNode& root = build.Blases[build.ModelBlasIndices[i]]->Builder->GetBvh()[0];
+        const glm::mat4& modelMatrix = build.ModelMatrices[i];
+
+        for (uint32_t corner = 0; corner < 8; corner++) {
+            glm::vec3 point{
+                corner & 1 ? root.Max.x : root.Min.x,
+                corner & 2 ? root.Max.y : root.Min.y,
+                corner & 4 ? root.Max.z : root.Min.z
+            };
+            point = modelMatrix * glm::vec4(point, 1.0f);
+            instanceBounds[i].Min = glm::min(instanceBounds[i].Min, point);
+            instanceBounds[i].Max = glm::max(instanceBounds[i].Max, point);
+        }
+    }
+
+    TlasBuilder tlasBuilder(std::move(instanceBounds));
+    tlasBuilder.Build();
+    const auto& tlasNodes = tlasBuilder.GetBvh();
+    build.StackSizes.Tlas = tlasBuilder.GetDepth() + 1;
+
+    // Leaves address the models buffer directly, so it is uploaded in leaf order.
+    std::vector<ModelUBO> orderedModelUBOs;
+    orderedModelUBOs.reserve(build.ModelUBOs.size());
+    for (uint32_t modelIndex : tlasBuilder.GetInstanceOrder()) {
+        orderedModelUBOs.push_back(build.ModelUBOs[modelIndex]);
+    }
+
+    build.Buffers.TlasNodes = std::make_unique<StorageBuffer<BvhNode>>(
+        mVulkanManager, tlasNodes.data(), tlasNodes.size());
+    build.Buffers.ModelUBOs = std::make_unique<StorageBuffer<ModelUBO>>(
+        mVulkanManager, orderedModelUBOs.data(), orderedModelUBOs.size());
+}
+
+void Scene::BuildSphereBvh(SceneBuild& build) const {
+    std::vector<PrimitiveBounds> sphereBounds(build.Spheres.size());
+    for (uint32_t i = 0; i < build.Spheres.size(); i++) {
+        sphereBounds[i].Min = build.Spheres[i].position - glm::vec3(build.Spheres[i].radius);
+        sphereBounds[i].Max = build.Spheres[i].position + glm::vec3(build.Spheres[i].radius);
+    }
+
+    BvhBuilder sphereBuilder(std::move(sphereBounds), build.Settings);
+    sphereBuilder.Build(false);
+    const auto& sphereNodes = sphereBuilder.GetBvh();
+    build.StackSizes.Spheres = sphereBuilder.GetDepth() + 1;
+
+    // Leaves address the spheres buffer directly, so it is uploaded in leaf order.
+    std::vector<Sphere> orderedSpheres;
+    orderedSpheres.reserve(build.Spheres.size());
+    for (uint32_t sphereIndex : sphereBuilder.GetTriangleIndices()) {
+        orderedSpheres.push_back(build.Spheres[sphereIndex]);
+    }
+
+    build.Buffers.Spheres = std::make_unique<StorageBuffer<Sphere>>(
+        mVulkanManager, orderedSpheres.data(), orderedSpheres.size());
+    build.Buffers.SphereNodes = std::make_unique<StorageBuffer<BvhNode>>(
+        mVulkanManager, sphereNodes.data(), sphereNodes.size());
+}
+
+bool SameMaterial(const Material& a, const Material& b) {
+    return a.color == b.color && a.metalness == b.metalness && a.emission_color == b.emission_color;
 }
 
 void Scene::VisitSphere(std::function<bool(Sphere&, Material&)> func) {
-    bool modified = false;
     for (size_t i = 0; i < mSpheres.size(); ++i) {
         auto& sphere = mSpheres[i];
         auto& material = mMaterials[sphere.materialIndex];
-        modified |= func(sphere, material);
-    }
+        Sphere previousSphere = sphere;
+        Material previousMaterial = material;
+        if (!func(sphere, material)) {
+            continue;
+        }
 
-    mRebuild |= modified;
+        if (!SameMaterial(material, previousMaterial)) {
+            mDirtyMaterials.Mark(sphere.materialIndex);
+        }
+
+        // The spheres buffer is in leaf order of their tree, so changing a
+        // sphere itself goes through a rebuild.
+        if (sphere.position != previousSphere.position || sphere.radius != previousSphere.radius ||
+            sphere.materialIndex != previousSphere.materialIndex) {
+            mModifiedSpheres = true;
+            mRebuild = true;
+        }
+    }
 }
 
 void Scene::VisitPlane(std::function<bool(Plane&, Material&)> func) {
-    bool modified = false;
     for (size_t i = 0; i < mPlanes.size(); ++i) {
         auto& plane = mPlanes[i];
         auto& material = mMaterials[plane.materialIndex];
-        modified |= func(plane, material);
+        if (func(plane, material)) {
+            mDirtyPlanes.Mark(i);
+            mDirtyMaterials.Mark(plane.materialIndex);
+        }
     }
-
-    mRebuild |= modified;
 }
 
 void Scene::VisitModel(std::function<bool(Model&, Material&)> func) {
-    bool modified = false;
     for (size_t i = 0; i < mModels.size(); ++i) {
         auto& model = mModels[i];
-        auto& material = mMaterials[i];
-        modified |= func(model, material);
-    }
+        auto& material = mMaterials[mModelUBOs[i].MaterialIndex];
+        Material previousMaterial = material;
+        if (!func(model, material)) {
+            continue;
+        }
 
-    mRebuild |= modified;
-}
\ No newline at end of file
+        if (!SameMaterial(material, previousMaterial)) {
+            mDirtyMaterials.Mark(mModelUBOs[i].MaterialIndex);
+        }
+        if (model.GetUpdate()) {
+            mModifiedTransforms = true;
+            mRebuild = true;
+        }
+    }
+}
@@ -1,10 +1,18 @@
 #pragma once
 
-#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "Core/Model.h"
 #include "Core/BvhBuilder.h"
+#include "Core/BvhCache.h"
+#include "Core/WideBvh.h"
 #include "Vulkan/Buffer.hpp"
 #include "Vulkan/VulkanManager.h"
 #include "Vulkan/CommandBuffer.h"
@@ -12,16 +20,65 @@
 #include "Core/VulkanComputeApp.h"
 
 struct ModelUBO {
+    glm::mat4 WorldToObject{ 1.0f };
     uint32_t TriangleOffset;
     uint32_t BvhOffset;
     uint32_t MaterialIndex;
+    uint32_t Padding;
+    // Grid of the quantized positions of the mesh, see QuantizeVertices.
+    glm::vec4 PositionOrigin{ 0.0f };
+    glm::vec4 PositionScale{ 0.0f };
 };
 
+/**
+ * @brief Traversal stack sizes RayTracer.comp needs for the uploaded trees,
+ * passed to the pipeline as specialization constants 0, 1 and 2 in field
+ * order.
+ */
+struct TraversalStackSizes {
+    uint32_t Blas{ 1 };
+    uint32_t Tlas{ 1 };
+    uint32_t Spheres{ 1 };
+
+    bool operator==(const TraversalStackSizes&) const = default;
+};
+
+/**
+ * @brief Scene geometry and the device buffers RayTracer.comp reads it from.
+ *
+ * Material and plane edits are written into their buffers in place. Anything
+ * that changes a tree (adding models, moving instances, spheres or vertices, changing
+ * the BVH settings) is rebuilt on a worker thread from a snapshot of the
+ * scene, into a fresh set of device buffers. The finished set replaces the
+ * active one at the start of a frame, and the previous set is destroyed once
+ * the frames that may still read it completed, so the viewport keeps
+ * rendering the previous scene while a rebuild runs.
+ */
 class Scene {
 public:
     Scene(const std::shared_ptr<VulkanManager>& vulkanManager, const std::shared_ptr<Shader>& shader, VulkanComputeApp* app);
+    ~Scene();
 
     void AddModel(Model model);
+    /**
+     * @brief Adds many models at once.
+     *
+     * The scene arrays grow once for the whole batch, and the BVHs of all
+     * meshes the scene has not seen yet are built in parallel by the next
+     * rebuild, which uploads the models together.
+     */
+    void AddModels(std::vector<Model> models);
+    /**
+     * @brief Moves the vertices of a mesh, for every model instancing it.
+     *
+     * The next rebuild refits the BVH of the mesh instead of building it
+     * again, and only builds it from scratch once refits degraded it past
+     * BvhBuildSettings::RebuildThreshold. The normals are kept.
+     *
+     * @param mesh Mesh of a model in the scene.
+     * @param positions New position of each vertex of the mesh.
+     */
+    void UpdateMeshPositions(const Mesh& mesh, std::vector<glm::vec3> positions);
     void AddSphere(Sphere sphere, const Material material);
     void AddPlane(Plane plane, const Material material);
 
@@ -29,34 +86,213 @@ public:
     void VisitPlane(std::function<bool(Plane&, Material&)> func);
     void VisitModel(std::function<bool(Model&, Material&)> func);
 
+    /**
+     * @brief Swaps in a finished rebuild, starts the next one if the scene
+     * changed since, and records the in place edits into the command buffer.
+     *
+     * Waits for the rebuild only when there is no scene to render yet.
+     *
+     * @return true if a rebuild was swapped in, so the frames rendered so far
+     * show the previous scene.
+     */
+    bool Update(const std::shared_ptr<CommandBuffer>& commandBuffer);
     void Draw(const std::shared_ptr<CommandBuffer>& commandBuffer);
 
+    [[nodiscard]] const BvhBuildSettings& GetBvhSettings() const { return mBvhSettings; }
+    void SetBvhSettings(const BvhBuildSettings& settings);
+    /**
+     * @brief Settings the buffers being rendered were built with, which lag
+     * behind GetBvhSettings while a rebuild runs.
+     */
+    [[nodiscard]] const BvhBuildSettings& GetActiveBvhSettings() const { return mActiveBvhSettings; }
+
+    /**
+     * @brief Macros RayTracer.comp has to be compiled with to match the
+     * node layout produced by the given settings.
+     */
+    static std::map<std::string, std::string> GetShaderDefines(const BvhBuildSettings& settings);
+    void SetShader(const std::shared_ptr<Shader>& shader) { mShader = shader; }
+
+    [[nodiscard]] const TraversalStackSizes& GetStackSizes() const { return mStackSizes; }
+
+    /**
+     * @brief Traces rays through every mesh BVH with each node order on the
+     * CPU and logs how fast each order is.
+     */
+    void BenchmarkBvhs() const;
+
+    /**
+     * @brief Moves the buffers being rendered out of sparsely used GPU memory
+     * blocks so the blocks can be released.
+     *
+     * The buffers are moved at the start of the next Update once no rebuild
+     * is running, since a rebuild fills its buffers on another thread.
+     */
+    void Defragment() { mDefragment = true; }
+
 private:
-    bool mModifiedSpheres{ false };
-    bool mModifiedPlanes{ false };
+    // Object space BVH shared by every model instancing the same mesh.
+    struct Blas {
+        const Mesh* Source;
+        // Owns Source when the vertices of the mesh were moved.
+        std::shared_ptr<const Mesh> Deformed;
+        std::unique_ptr<BvhBuilder> Builder;
+        std::unique_ptr<WideBvh> Nodes;
+        // Step between quantized positions along each axis, starting at the
+        // mesh bounds.
+        glm::vec3 PositionOrigin{ 0.0f };
+        glm::vec3 PositionScale{ 0.0f };
+    };
+
+    // Buffers of the arrays a rebuild replaces as a whole. The spheres are
+    // stored in the leaf order of their BVH and the instance transforms must
+    // match the TLAS built over them, so neither gets a dirty range: writing
+    // them in place would pair them with the trees of the previous build.
+    struct GpuScene {
+        std::unique_ptr<StorageBuffer<Sphere>> Spheres;
+        std::unique_ptr<StorageBuffer<BvhNode>> SphereNodes;
+        std::unique_ptr<StorageBuffer<GpuTriangle>> Triangles;
+        std::unique_ptr<StorageBuffer<uint32_t>> Indices;
+        std::unique_ptr<StorageBuffer<uint32_t>> Positions;
+        std::unique_ptr<StorageBuffer<uint32_t>> Normals;
+        std::unique_ptr<StorageBuffer<uint32_t>> BvhNodes;
+        std::unique_ptr<StorageBuffer<BvhNode>> TlasNodes;
+        std::unique_ptr<StorageBuffer<ModelUBO>> ModelUBOs;
+    };
+
+    /**
+     * @brief Snapshot of the scene a rebuild works on, and what it produces.
+     *
+     * The worker only touches the build it was given, the scene only reads it
+     * back once the build completed.
+     */
+    struct SceneBuild {
+        BvhBuildSettings Settings;
+        bool RebuildModels{ false };
+        bool RebuildTlas{ false };
+        bool RebuildSpheres{ false };
+
+        // Built mesh BVHs, null for the meshes still to build.
+        std::vector<std::shared_ptr<const Blas>> Blases;
+        // Previous BVH of the meshes whose vertices moved, which are refitted
+        // instead of built.
+        std::vector<std::shared_ptr<const Blas>> RefitBlases;
+        std::vector<const Mesh*> Meshes;
+        std::vector<std::shared_ptr<const Mesh>> DeformedMeshes;
+        std::vector<uint32_t> ModelBlasIndices;
+        std::vector<ModelUBO> ModelUBOs;
+        std::vector<glm::mat4> ModelMatrices;
+        std::vector<Sphere> Spheres;
+
+        TraversalStackSizes StackSizes;
+        GpuScene Buffers;
+    };
+
+    /**
+     * @brief Mesh data of every BLAS, concatenated in the layout RayTracer.comp
+     * reads it in.
+     *
+     * The indices of each mesh follow the leaf order of its BVH and address
+     * the vertices of all meshes. Positions and normals are tightly packed
+     * xyz triples of floats, or of 16-bit integers and one octahedral word
+     * when the vertices are quantized. Positions are only gathered for the
+     * indexed triangle format, the others only the encoded triangles, the
+     * normals are always gathered for shading.
+     */
+    struct BlasArrays {
+        std::vector<GpuTriangle> Triangles;
+        std::vector<uint32_t> Indices;
+        std::vector<uint32_t> Positions;
+        std::vector<uint32_t> Normals;
+        std::vector<uint32_t> BvhNodes;
+    };
+
+    // Buffers replaced by a rebuild, kept until the last frame reading them
+    // completed.
+    struct RetiredScene {
+        GpuScene Buffers;
+        // Frame that swapped the buffers out, see RetireBuffers.
+        uint64_t Frame;
+    };
+
+    // Span of array elements changed since the array was last uploaded.
+    struct DirtyRange {
+        size_t First{ SIZE_MAX };
+        size_t End{ 0 };
+
+        void Mark(size_t first, size_t count = 1) {
+            First = std::min(First, first);
+            End = std::max(End, first + count);
+        }
+        [[nodiscard]] bool Empty() const { return First >= End; }
+    };
+
+    /**
+     * @brief Writes the dirty range of an array into its buffer, creating
+     * the buffer on first use and growing it when the array outgrew it.
+     */
+    template <typename T>
+    void UploadArray(VkCommandBuffer commandBuffer, const std::vector<T>& data, DirtyRange& dirty,
+                     std::unique_ptr<StorageBuffer<T>>& buffer);
+
+    uint32_t GetOrAddBlas(const Mesh& mesh);
+    void AppendModel(Model model, uint32_t blasIndex);
+
+    void StartBuild();
+    void FinishBuild();
+    void RetireBuffers(uint64_t framesInFlight);
+    void DefragmentBuffers();
+
+    // Run on the worker, they only read the scene members that never change.
+    void ExecuteBuild(SceneBuild& build) const;
+    void BuildBlas(Blas& blas, const BvhBuildSettings& settings, const Blas* previous) const;
+    void BuildBlases(SceneBuild& build) const;
+    void GatherBlasData(SceneBuild& build, BlasArrays& arrays) const;
+    void BuildTlas(SceneBuild& build) const;
+    void BuildSphereBvh(SceneBuild& build) const;
+
+    // Set initially so the sphere buffers exist even without spheres.
+    bool mModifiedSpheres{ true };
     bool mModifiedModels{ false };
+    bool mModifiedTransforms{ false };
 
     std::vector<Sphere> mSpheres;
     std::vector<Plane> mPlanes;
-    std::vector<Triangle> mTriangles;
     std::vector<Model> mModels;
-    std::vector<BvhNode> mBvhNodes;
+    std::vector<const Mesh*> mMeshes;
+    // Moved vertices of each mesh, null while it is unchanged.
+    std::vector<std::shared_ptr<const Mesh>> mDeformedMeshes;
+    std::vector<uint32_t> mDeformedBlases;
+    std::vector<std::shared_ptr<const Blas>> mBlases;
+    std::unordered_map<const Mesh*, uint32_t> mBlasIndices;
+    std::vector<uint32_t> mModelBlasIndices;
     std::vector<Material> mMaterials;
     std::vector<ModelUBO> mModelUBOs;
+    BvhBuildSettings mBvhSettings;
+    BvhBuildSettings mActiveBvhSettings;
+    BvhCache mBvhCache;
+    TraversalStackSizes mStackSizes;
+
+    DirtyRange mDirtyPlanes;
+    DirtyRange mDirtyMaterials;
 
-    std::unique_ptr<StorageBuffer<Sphere>> mSpheresBuffer;
     std::unique_ptr<StorageBuffer<Plane>> mPlanesBuffer;
-    std::unique_ptr<StorageBuffer<Triangle>> mTrianglesBuffer;
     std::unique_ptr<StorageBuffer<Material>> mMaterialsBuffer;
-    std::unique_ptr<StorageBuffer<ModelUBO>> mModelUBOsBuffer;
-    std::unique_ptr<StorageBuffer<BvhNode>> mBvhNodesBuffer;
+    GpuScene mActiveScene;
+    std::vector<RetiredScene> mRetiredScenes;
+
+    std::unique_ptr<SceneBuild> mBuild;
+    std::future<void> mBuildDone;
+    uint64_t mFrame{ 0 };
 
     std::shared_ptr<VulkanManager> mVulkanManager;
     std::shared_ptr<Shader> mShader;
     VulkanComputeApp* mApp;
 
-    bool mRebuild{ false };
-    uint32_t mNumTriangles{ 0 };
+    // Set initially so every buffer exists before the first dispatch.
+    bool mRebuild{ true };
+    bool mRebuildBvhs{ false };
+    bool mDefragment{ false };
 
     std::unique_ptr<ComputePipeline> mVertexPipeline;
-};
\ No newline at end of file
+};
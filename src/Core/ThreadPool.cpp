@@ -0,0 +1,190 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+static thread_local const ThreadPool* sWorkerPool = nullptr;
+static thread_local uint32_t sWorkerIndex = 0;
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+    threadCount = std::max(threadCount, 1u);
+
+    // One queue per worker plus the injection queue for external threads.
+    for (uint32_t i = 0; i <= threadCount; i++) {
+        mQueues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (uint32_t i = 0; i < threadCount; i++) {
+        mThreads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mSleepMutex);
+        mStop = true;
+    }
+    mWakeCondition.notify_all();
+
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+ThreadPool& ThreadPool::Global() {
+    static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return pool;
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+    Enqueue(std::move(task), nullptr);
+}
+
+void ThreadPool::Enqueue(std::function<void()> task, const TaskGroup* group) {
+    uint32_t queueIndex = sWorkerPool == this ? sWorkerIndex : ThreadCount();
+    {
+        std::lock_guard lock(mQueues[queueIndex]->Mutex);
+        mQueues[queueIndex]->Tasks.push_back({ std::move(task), group });
+    }
+
+    {
+        std::lock_guard lock(mSleepMutex);
+        mPendingTasks++;
+    }
+    mWakeCondition.notify_one();
+}
+
+bool ThreadPool::RunPendingTask(const TaskGroup* group) {
+    uint32_t queueIndex = sWorkerPool == this ? sWorkerIndex : ThreadCount();
+
+    std::function<void()> task;
+    if (!PopTask(queueIndex, group, task)) {
+        return false;
+    }
+
+    task();
+    return true;
+}
+
+bool ThreadPool::PopTask(uint32_t queueIndex, const TaskGroup* group, std::function<void()>& task) {
+    auto matches = [group](const Task& candidate) { return !group || candidate.Group == group; };
+
+    {
+        auto& queue = *mQueues[queueIndex];
+        std::lock_guard lock(queue.Mutex);
+        auto it = std::find_if(queue.Tasks.rbegin(), queue.Tasks.rend(), matches);
+        if (it != queue.Tasks.rend()) {
+            task = std::move(it->Func);
+            queue.Tasks.erase(std::next(it).base());
+            mPendingTasks--;
+            return true;
+        }
+    }
+
+    for (uint32_t i = 1; i < mQueues.size(); i++) {
+        auto& queue = *mQueues[(queueIndex + i) % mQueues.size()];
+        std::lock_guard lock(queue.Mutex);
+        auto it = std::find_if(queue.Tasks.begin(), queue.Tasks.end(), matches);
+        if (it != queue.Tasks.end()) {
+            task = std::move(it->Func);
+            queue.Tasks.erase(it);
+            mPendingTasks--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::WorkerLoop(uint32_t workerIndex) {
+    sWorkerPool = this;
+    sWorkerIndex = workerIndex;
+
+    while (true) {
+        {
+            std::unique_lock lock(mSleepMutex);
+            mWakeCondition.wait(lock, [this]() {
+                return mStop || mPendingTasks > 0;
+            });
+
+            if (mStop) {
+                return;
+            }
+        }
+
+        std::function<void()> task;
+        if (PopTask(workerIndex, nullptr, task)) {
+            task();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : mPool(pool) {}
+
+TaskGroup::~TaskGroup() {
+    // Tasks still reference the group, so it cannot go away before they did.
+    WaitForTasks();
+}
+
+void TaskGroup::Run(std::function<void()> task) {
+    {
+        std::lock_guard lock(mMutex);
+        mPendingTasks++;
+    }
+
+    mPool.Enqueue([this, task = std::move(task)]() {
+        std::exception_ptr exception;
+        try {
+            task();
+        } catch (...) {
+            exception = std::current_exception();
+        }
+
+        // Notified under the lock, since the waiter may destroy the group as
+        // soon as it sees the last task complete.
+        std::lock_guard lock(mMutex);
+        if (exception && !mException) {
+            mException = exception;
+        }
+        if (--mPendingTasks == 0) {
+            mDoneCondition.notify_all();
+        }
+    }, this);
+}
+
+void TaskGroup::Wait() {
+    WaitForTasks();
+
+    std::exception_ptr exception;
+    {
+        std::lock_guard lock(mMutex);
+        exception = std::exchange(mException, nullptr);
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+void TaskGroup::WaitForTasks() {
+    while (true) {
+        {
+            std::lock_guard lock(mMutex);
+            if (mPendingTasks == 0) {
+                return;
+            }
+        }
+
+        if (!mPool.RunPendingTask(this)) {
+            break;
+        }
+    }
+
+    // Every remaining task is running on another thread, and only those can
+    // add tasks to the group, which they then run themselves or leave to
+    // the workers.
+    std::unique_lock lock(mMutex);
+    mDoneCondition.wait(lock, [this]() { return mPendingTasks == 0; });
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class TaskGroup;
+
+/**
+ * @brief Work-stealing thread pool used to run CPU side jobs.
+ *
+ * Every worker owns a task queue: tasks enqueued from a worker are pushed to
+ * its own queue and popped in LIFO order, while idle workers steal the oldest
+ * tasks from the other queues. Tasks enqueued from threads outside the pool go
+ * to a shared injection queue.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Constructs a thread pool with the given number of workers.
+     *
+     * @param threadCount Number of worker threads, at least one is created.
+     */
+    explicit ThreadPool(uint32_t threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Gets the application wide thread pool.
+     *
+     * The pool is created on first use with one worker less than the number
+     * of hardware threads, since the calling thread usually helps executing
+     * tasks while waiting for them.
+     *
+     * @return Reference to the global ThreadPool instance.
+     */
+    static ThreadPool& Global();
+
+    /**
+     * @brief Enqueues a task to be executed by the pool.
+     *
+     * @param task Function to execute.
+     */
+    void Enqueue(std::function<void()> task);
+    /**
+     * @brief Enqueues a task and returns a future holding its result.
+     *
+     * @param func Function to execute, called without arguments.
+     * @return Future that becomes ready once the task has run.
+     */
+    template <typename F>
+    auto Submit(F&& func) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+
+        // std::function needs a copyable target, the task itself is move only.
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(func));
+        std::future<Result> result = task->get_future();
+        Enqueue([task]() { (*task)(); });
+        return result;
+    }
+    /**
+     * @brief Executes a single pending task on the calling thread, if any.
+     *
+     * Used by threads waiting on tasks to help the pool instead of blocking.
+     *
+     * @param group Only runs a task of this group, or any task if null.
+     * @return true if a task was executed, false if no task was available.
+     */
+    bool RunPendingTask(const TaskGroup* group = nullptr);
+
+    [[nodiscard]] inline uint32_t ThreadCount() const {
+        return static_cast<uint32_t>(mThreads.size());
+    }
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> Func;
+        // Group the task belongs to, null for tasks enqueued directly.
+        const TaskGroup* Group;
+    };
+
+    struct WorkQueue {
+        std::mutex Mutex;
+        std::deque<Task> Tasks;
+    };
+
+    void Enqueue(std::function<void()> task, const TaskGroup* group);
+    void WorkerLoop(uint32_t workerIndex);
+    bool PopTask(uint32_t queueIndex, const TaskGroup* group, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    std::vector<std::thread> mThreads;
+
+    std::mutex mSleepMutex;
+    std::condition_variable mWakeCondition;
+    std::atomic<int64_t> mPendingTasks{ 0 };
+    bool mStop{ false };
+};
+
+/**
+ * @brief Group of tasks that can be waited on together.
+ *
+ * Waiting on a group executes the pending tasks of that group on the calling
+ * thread, so tasks can recursively spawn and wait on nested groups without
+ * deadlocking the pool. Unrelated tasks are left to the workers, a wait
+ * inside a mesh build never picks up a whole scene rebuild. Once none of its
+ * tasks are left to run, the waiting thread sleeps until the ones running on
+ * other threads completed.
+ *
+ * An exception thrown by a task does not stop the other tasks; the first one
+ * is rethrown by Wait.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::Global());
+    ~TaskGroup();
+
+    /**
+     * @brief Runs a task as part of the group.
+     *
+     * @param task Function to execute.
+     */
+    void Run(std::function<void()> task);
+    /**
+     * @brief Blocks until all the tasks of the group have completed.
+     *
+     * Rethrows the first exception a task of the group threw since the last
+     * wait. The destructor waits as well, but drops the exception.
+     */
+    void Wait();
+
+private:
+    void WaitForTasks();
+
+    ThreadPool& mPool;
+    std::mutex mMutex;
+    std::condition_variable mDoneCondition;
+    uint32_t mPendingTasks{ 0 };
+    std::exception_ptr mException;
+};
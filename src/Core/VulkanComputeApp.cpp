@@ -50,6 +50,8 @@ void VulkanComputeApp::MainLoop() {
         mGui->End(mCommandBuffer);
 
         mCommandBuffer->End();
+        // Everything uploaded while the frame was recorded lands before it.
+        mVulkanManager->FlushUploads();
         mSurface->SubmitCommandBuffer(mCommandBuffer, imageIndex);
     }
 
@@ -0,0 +1,387 @@
+#include "WideBvh.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+WideBvh::WideBvh(const std::vector<BvhNode>& bvh, uint32_t width, uint32_t quantizationBits)
+    : mWidth(std::clamp(width, 2u, 8u)),
+      mQuantizationBits(quantizationBits == 8 || quantizationBits == 16 ? quantizationBits : 0) {
+    mNodes.reserve(bvh.size() * GetNodeStride() / (mWidth - 1));
+
+    uint32_t root = AllocateNode();
+    if (bvh.empty()) {
+        WriteNode(root, {});
+        return;
+    }
+
+    // A tree that is a single leaf still needs an interior node to hold it.
+    if (bvh[0].ChildIndex == 0) {
+        std::vector<Child> children;
+        AddLeaf(children, bvh[0], bvh[0].TriangleIndex, bvh[0].TriangleCount, 1);
+        WriteNode(root, children);
+        return;
+    }
+
+    Collapse(bvh, 0, root, 1);
+}
+
+uint32_t WideBvh::GetNodeStride() const {
+    if (mQuantizationBits == 0) {
+        return 8 * mWidth;
+    }
+
+    uint32_t boundsWords = (6 * mWidth * mQuantizationBits + 31) / 32;
+    return 4 + boundsWords + mWidth;
+}
+
+uint32_t WideBvh::AllocateNode() {
+    uint32_t index = GetNodeCount();
+    mNodes.resize(mNodes.size() + GetNodeStride(), 0);
+    return index;
+}
+
+void WideBvh::Collapse(const std::vector<BvhNode>& bvh, uint32_t binaryIndex, uint32_t wideIndex, uint32_t depth) {
+    mDepth = std::max(mDepth, depth);
+
+    std::vector<uint32_t> binaryChildren = {
+        bvh[binaryIndex].ChildIndex,
+        bvh[binaryIndex].ChildIndex + 1
+    };
+
+    // Open the interior child with the largest area, it is the one most
+    // likely to be visited, until the node is full.
+    while (binaryChildren.size() < mWidth) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (uint32_t i = 0; i < binaryChildren.size(); i++) {
+            const BvhNode& child = bvh[binaryChildren[i]];
+            if (child.ChildIndex != 0 && SurfaceArea(child) > largestArea) {
+                largest = static_cast<int>(i);
+                largestArea = SurfaceArea(child);
+            }
+        }
+
+        if (largest < 0) {
+            break;
+        }
+
+        uint32_t opened = bvh[binaryChildren[largest]].ChildIndex;
+        binaryChildren[largest] = opened;
+        binaryChildren.push_back(opened + 1);
+    }
+
+    std::vector<Child> children;
+    std::vector<std::pair<uint32_t, uint32_t>> interiorChildren;
+    for (uint32_t childIndex : binaryChildren) {
+        const BvhNode& child = bvh[childIndex];
+        if (child.ChildIndex == 0) {
+            AddLeaf(children, child, child.TriangleIndex, child.TriangleCount, depth);
+            continue;
+        }
+
+        uint32_t wideChild = AllocateNode();
+        children.push_back({ child, wideChild, 0 });
+        interiorChildren.emplace_back(childIndex, wideChild);
+    }
+
+    WriteNode(wideIndex, children);
+
+    for (const auto& [childIndex, wideChild] : interiorChildren) {
+        Collapse(bvh, childIndex, wideChild, depth + 1);
+    }
+}
+
+void WideBvh::AddLeaf(std::vector<Child>& children, const BvhNode& bounds,
+                      uint32_t triangleIndex, uint32_t triangleCount, uint32_t depth) {
+    if (triangleCount == 0) {
+        return;
+    }
+
+    uint32_t maxLeafSize = mQuantizationBits == 0 ? UINT32_MAX : (1u << LEAF_COUNT_BITS) - 1;
+    if (triangleCount <= maxLeafSize) {
+        if (mQuantizationBits != 0 && triangleIndex + triangleCount > (1u << LEAF_OFFSET_BITS)) {
+            mValid = false;
+        }
+
+        children.push_back({ bounds, triangleIndex, triangleCount });
+        return;
+    }
+
+    // Leaves too large for the packed count are split into a node of
+    // smaller leaves sharing the same box.
+    std::vector<Child> leafChildren;
+    uint32_t chunkSize = std::max((triangleCount + mWidth - 1) / mWidth, 1u);
+    for (uint32_t first = 0; first < triangleCount; first += chunkSize) {
+        AddLeaf(leafChildren, bounds, triangleIndex + first, std::min(chunkSize, triangleCount - first), depth + 1);
+    }
+    mDepth = std::max(mDepth, depth + 1);
+
+    uint32_t wideChild = AllocateNode();
+    WriteNode(wideChild, leafChildren);
+    children.push_back({ bounds, wideChild, 0 });
+}
+
+void WideBvh::WriteNode(uint32_t wideIndex, const std::vector<Child>& children) {
+    if (mQuantizationBits != 0) {
+        WriteQuantizedNode(wideIndex, children);
+        return;
+    }
+
+    uint32_t* node = mNodes.data() + static_cast<size_t>(wideIndex) * GetNodeStride();
+    for (uint32_t slot = 0; slot < mWidth; slot++) {
+        Child child = slot < children.size() ? children[slot] : Child{ BvhNode{}, 0, 0 };
+
+        node[0 * mWidth + slot] = std::bit_cast<uint32_t>(child.Bounds.Min.x);
+        node[1 * mWidth + slot] = std::bit_cast<uint32_t>(child.Bounds.Min.y);
+        node[2 * mWidth + slot] = std::bit_cast<uint32_t>(child.Bounds.Min.z);
+        node[3 * mWidth + slot] = std::bit_cast<uint32_t>(child.Bounds.Max.x);
+        node[4 * mWidth + slot] = std::bit_cast<uint32_t>(child.Bounds.Max.y);
+        node[5 * mWidth + slot] = std::bit_cast<uint32_t>(child.Bounds.Max.z);
+        node[6 * mWidth + slot] = child.Index;
+        node[7 * mWidth + slot] = child.TriangleCount;
+    }
+}
+
+void WideBvh::WriteQuantizedNode(uint32_t wideIndex, const std::vector<Child>& children) {
+    uint32_t* node = mNodes.data() + static_cast<size_t>(wideIndex) * GetNodeStride();
+    uint32_t* bounds = node + 4;
+    uint32_t* childWords = node + GetNodeStride() - mWidth;
+    const uint32_t maxQuantized = (1u << mQuantizationBits) - 1;
+
+    BvhNode box;
+    for (const auto& child : children) {
+        box.Min = glm::min(box.Min, child.Bounds.Min);
+        box.Max = glm::max(box.Max, child.Bounds.Max);
+    }
+    if (children.empty()) {
+        box.Min = glm::vec3(0.0f);
+        box.Max = glm::vec3(0.0f);
+    }
+
+    // Power of two scales make the decode exact up to the final addition.
+    glm::vec3 scale;
+    uint32_t exponents = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        int exponent = -126;
+        float extent = box.Max[axis] - box.Min[axis];
+        if (extent > 0.0f) {
+            std::frexp(extent / maxQuantized, &exponent);
+            exponent = std::clamp(exponent, -126, 127);
+            while (exponent > -126 && std::ldexp(static_cast<float>(maxQuantized), exponent - 1) >= extent) {
+                exponent--;
+            }
+        }
+
+        scale[axis] = std::ldexp(1.0f, exponent);
+        exponents |= static_cast<uint32_t>(exponent + 127) << (axis * 8);
+    }
+
+    node[0] = std::bit_cast<uint32_t>(box.Min.x);
+    node[1] = std::bit_cast<uint32_t>(box.Min.y);
+    node[2] = std::bit_cast<uint32_t>(box.Min.z);
+    node[3] = exponents;
+
+    auto writeBound = [&](uint32_t index, uint32_t value) {
+        uint32_t bit = index * mQuantizationBits;
+        bounds[bit / 32] |= value << (bit % 32);
+    };
+
+    for (uint32_t slot = 0; slot < mWidth; slot++) {
+        // Node 0 is the root and never a child, so a zero word marks the end
+        // of the children.
+        if (slot >= children.size()) {
+            childWords[slot] = 0;
+            continue;
+        }
+
+        const Child& child = children[slot];
+        for (int axis = 0; axis < 3; axis++) {
+            float origin = box.Min[axis];
+            auto decode = [&](uint32_t q) { return origin + static_cast<float>(q) * scale[axis]; };
+
+            auto qMin = static_cast<uint32_t>(std::clamp(
+                std::floor((child.Bounds.Min[axis] - origin) / scale[axis]), 0.0f, static_cast<float>(maxQuantized)));
+            while (qMin > 0 && decode(qMin) > child.Bounds.Min[axis]) {
+                qMin--;
+            }
+
+            auto qMax = static_cast<uint32_t>(std::clamp(
+                std::ceil((child.Bounds.Max[axis] - origin) / scale[axis]), 0.0f, static_cast<float>(maxQuantized)));
+            while (qMax < maxQuantized && decode(qMax) < child.Bounds.Max[axis]) {
+                qMax++;
+            }
+
+            writeBound(axis * mWidth + slot, qMin);
+            writeBound((axis + 3) * mWidth + slot, qMax);
+        }
+
+        if (child.TriangleCount > 0) {
+            childWords[slot] = LEAF_FLAG | (child.TriangleCount << LEAF_OFFSET_BITS) |
+                (child.Index & ((1u << LEAF_OFFSET_BITS) - 1));
+        } else {
+            childWords[slot] = child.Index;
+        }
+    }
+}
+
+uint32_t* WideBvh::GetChildWords(uint32_t nodeIndex) {
+    uint32_t* node = mNodes.data() + static_cast<size_t>(nodeIndex) * GetNodeStride();
+    return mQuantizationBits == 0 ? node + 6 * mWidth : node + GetNodeStride() - mWidth;
+}
+
+bool WideBvh::IsInteriorChild(const uint32_t* childWords, uint32_t slot) const {
+    // The root is never a child, so a zero word is either an unused slot or,
+    // with full precision, a leaf starting at the first triangle.
+    if (mQuantizationBits == 0) {
+        return childWords[slot] != 0 && childWords[mWidth + slot] == 0;
+    }
+    return childWords[slot] != 0 && (childWords[slot] & LEAF_FLAG) == 0;
+}
+
+void WideBvh::Reorder(BvhNodeOrder order) {
+    uint32_t nodeCount = GetNodeCount();
+    if (order == BvhNodeOrder::Build || nodeCount <= 2) {
+        return;
+    }
+
+    std::vector<uint32_t> nodeOrder;
+    nodeOrder.reserve(nodeCount);
+
+    if (order == BvhNodeOrder::DepthFirst) {
+        // Children are pushed in reverse, so the first one directly follows
+        // its parent.
+        std::vector<uint32_t> stack = { 0 };
+        while (!stack.empty()) {
+            uint32_t nodeIndex = stack.back();
+            stack.pop_back();
+            nodeOrder.push_back(nodeIndex);
+
+            const uint32_t* childWords = GetChildWords(nodeIndex);
+            for (uint32_t slot = mWidth; slot-- > 0;) {
+                if (IsInteriorChild(childWords, slot)) {
+                    stack.push_back(childWords[slot]);
+                }
+            }
+        }
+    } else {
+        // Every order emitted here stores children after their parent, so
+        // the heights are known once the nodes after a node are processed.
+        std::vector<uint32_t> heights(nodeCount, 1);
+        for (uint32_t nodeIndex = nodeCount; nodeIndex-- > 0;) {
+            const uint32_t* childWords = GetChildWords(nodeIndex);
+            for (uint32_t slot = 0; slot < mWidth; slot++) {
+                if (IsInteriorChild(childWords, slot)) {
+                    heights[nodeIndex] = std::max(heights[nodeIndex], heights[childWords[slot]] + 1);
+                }
+            }
+        }
+
+        std::vector<uint32_t> frontier;
+        LayoutVanEmdeBoas(0, heights[0], nodeOrder, frontier);
+    }
+
+    std::vector<uint32_t> newIndices(nodeCount);
+    for (uint32_t i = 0; i < nodeCount; i++) {
+        newIndices[nodeOrder[i]] = i;
+    }
+
+    std::vector<uint32_t> nodes(mNodes.size());
+    const uint32_t stride = GetNodeStride();
+    for (uint32_t i = 0; i < nodeCount; i++) {
+        std::copy_n(mNodes.begin() + static_cast<size_t>(nodeOrder[i]) * stride, stride,
+                    nodes.begin() + static_cast<size_t>(i) * stride);
+    }
+    mNodes = std::move(nodes);
+
+    for (uint32_t nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++) {
+        uint32_t* childWords = GetChildWords(nodeIndex);
+        for (uint32_t slot = 0; slot < mWidth; slot++) {
+            if (IsInteriorChild(childWords, slot)) {
+                childWords[slot] = newIndices[childWords[slot]];
+            }
+        }
+    }
+}
+
+void WideBvh::LayoutVanEmdeBoas(uint32_t root, uint32_t height, std::vector<uint32_t>& order,
+                                std::vector<uint32_t>& frontier) {
+    if (height == 1) {
+        order.push_back(root);
+
+        const uint32_t* childWords = GetChildWords(root);
+        for (uint32_t slot = 0; slot < mWidth; slot++) {
+            if (IsInteriorChild(childWords, slot)) {
+                frontier.push_back(childWords[slot]);
+            }
+        }
+        return;
+    }
+
+    // The top half of the subtree is laid out first, followed by each of the
+    // subtrees hanging below it.
+    uint32_t topHeight = height / 2;
+    std::vector<uint32_t> bottomRoots;
+    LayoutVanEmdeBoas(root, topHeight, order, bottomRoots);
+
+    for (uint32_t bottomRoot : bottomRoots) {
+        LayoutVanEmdeBoas(bottomRoot, height - topHeight, order, frontier);
+    }
+}
+
+uint32_t WideBvh::LoadChildren(uint32_t nodeIndex, Child* children) const {
+    const uint32_t* node = mNodes.data() + static_cast<size_t>(nodeIndex) * GetNodeStride();
+
+    if (mQuantizationBits == 0) {
+        uint32_t count = 0;
+        for (; count < mWidth; count++) {
+            Child& child = children[count];
+            child.Bounds.Min = glm::vec3(std::bit_cast<float>(node[0 * mWidth + count]),
+                                         std::bit_cast<float>(node[1 * mWidth + count]),
+                                         std::bit_cast<float>(node[2 * mWidth + count]));
+            child.Bounds.Max = glm::vec3(std::bit_cast<float>(node[3 * mWidth + count]),
+                                         std::bit_cast<float>(node[4 * mWidth + count]),
+                                         std::bit_cast<float>(node[5 * mWidth + count]));
+            if (child.Bounds.Min.x > child.Bounds.Max.x) {
+                break;
+            }
+
+            child.Index = node[6 * mWidth + count];
+            child.TriangleCount = node[7 * mWidth + count];
+        }
+        return count;
+    }
+
+    const uint32_t* bounds = node + 4;
+    const uint32_t* childWords = node + GetNodeStride() - mWidth;
+    const glm::vec3 origin(std::bit_cast<float>(node[0]), std::bit_cast<float>(node[1]),
+                           std::bit_cast<float>(node[2]));
+    const glm::vec3 scale(std::bit_cast<float>((node[3] & 0xFFu) << 23),
+                          std::bit_cast<float>(((node[3] >> 8) & 0xFFu) << 23),
+                          std::bit_cast<float>(((node[3] >> 16) & 0xFFu) << 23));
+    const uint32_t mask = (1u << mQuantizationBits) - 1;
+
+    auto readBound = [&](uint32_t index) {
+        uint32_t bit = index * mQuantizationBits;
+        return static_cast<float>((bounds[bit / 32] >> (bit % 32)) & mask);
+    };
+
+    uint32_t count = 0;
+    for (; count < mWidth && childWords[count] != 0; count++) {
+        Child& child = children[count];
+        for (int axis = 0; axis < 3; axis++) {
+            child.Bounds.Min[axis] = origin[axis] + readBound(axis * mWidth + count) * scale[axis];
+            child.Bounds.Max[axis] = origin[axis] + readBound((axis + 3) * mWidth + count) * scale[axis];
+        }
+
+        uint32_t childWord = childWords[count];
+        if ((childWord & LEAF_FLAG) != 0) {
+            child.Index = childWord & ((1u << LEAF_OFFSET_BITS) - 1);
+            child.TriangleCount = (childWord & ~LEAF_FLAG) >> LEAF_OFFSET_BITS;
+        } else {
+            child.Index = childWord;
+            child.TriangleCount = 0;
+        }
+    }
+    return count;
+}
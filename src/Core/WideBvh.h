@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+
+#include "Core/BvhBuilder.h"
+
+/**
+ * @brief GPU layout of a BVH with up to Width children per node.
+ *
+ * A binary BVH is collapsed by repeatedly opening the child with the largest
+ * surface area until a node holds Width children. The boxes of all children
+ * are stored in their parent as structure of arrays, so a node is fetched
+ * once and all of its children are tested together. Children are packed to
+ * the front of a node.
+ *
+ * With full precision a node is 8 * Width 32-bit words, laid out as Width
+ * entries of MinX, MinY, MinZ, MaxX, MaxY, MaxZ, Child and TriangleCount,
+ * which matches the std430 WideBvhNode struct in RayTracer.comp. A slot with
+ * a TriangleCount of 0 is an interior child and Child is its node index,
+ * otherwise Child is the offset of its triangles. Unused slots have an empty
+ * box.
+ *
+ * With 8 or 16 quantization bits a node starts with the origin of its box as
+ * three floats and a word holding the biased power of two scale of each axis.
+ * The child bounds follow as 6 * Width integers in the same axis order, packed
+ * tightly into words, rounded outwards so the decoded box is conservative.
+ * The node ends with one word per child that is either an interior node index
+ * or, with the top bit set, a leaf holding the triangle count and offset. A
+ * zero word ends the children of a quantized node.
+ */
+class WideBvh {
+public:
+    static constexpr uint32_t LEAF_FLAG = 1u << 31;
+    static constexpr uint32_t LEAF_COUNT_BITS = 8;
+    static constexpr uint32_t LEAF_OFFSET_BITS = 23;
+
+    WideBvh(const std::vector<BvhNode>& bvh, uint32_t width, uint32_t quantizationBits = 0);
+
+    struct Child {
+        BvhNode Bounds;
+        uint32_t Index;
+        uint32_t TriangleCount;
+    };
+
+    /**
+     * @brief Moves the nodes into the given order, rewriting the child
+     * indices. The root stays the first node.
+     */
+    void Reorder(BvhNodeOrder order);
+
+    /**
+     * @brief Decodes the children of a node the same way loadBvhChild in
+     * RayTracer.comp does, for traversals on the CPU.
+     *
+     * @param nodeIndex Node to decode.
+     * @param children Receives up to GetWidth() children.
+     * @return The number of children of the node.
+     */
+    uint32_t LoadChildren(uint32_t nodeIndex, Child* children) const;
+
+    [[nodiscard]] const std::vector<uint32_t>& GetNodes() const {
+        return mNodes;
+    }
+
+    [[nodiscard]] uint32_t GetWidth() const {
+        return mWidth;
+    }
+
+    /**
+     * @brief Depth of the collapsed tree, which bounds the traversal stack.
+     */
+    [[nodiscard]] uint32_t GetDepth() const {
+        return mDepth;
+    }
+
+    [[nodiscard]] uint32_t GetNodeCount() const {
+        return static_cast<uint32_t>(mNodes.size() / GetNodeStride());
+    }
+
+    /**
+     * @brief Size of a node in 32-bit words.
+     */
+    [[nodiscard]] uint32_t GetNodeStride() const;
+
+    /**
+     * @brief Whether every leaf could be encoded. A quantized leaf addresses
+     * its triangles with LEAF_OFFSET_BITS, so the nodes of a larger mesh are
+     * corrupt and must be collapsed again with full precision.
+     */
+    [[nodiscard]] bool IsValid() const {
+        return mValid;
+    }
+
+private:
+    uint32_t AllocateNode();
+    void Collapse(const std::vector<BvhNode>& bvh, uint32_t binaryIndex, uint32_t wideIndex, uint32_t depth);
+    void AddLeaf(std::vector<Child>& children, const BvhNode& bounds,
+                 uint32_t triangleIndex, uint32_t triangleCount, uint32_t depth);
+    void WriteNode(uint32_t wideIndex, const std::vector<Child>& children);
+    void WriteQuantizedNode(uint32_t wideIndex, const std::vector<Child>& children);
+    uint32_t* GetChildWords(uint32_t nodeIndex);
+    bool IsInteriorChild(const uint32_t* childWords, uint32_t slot) const;
+    void LayoutVanEmdeBoas(uint32_t root, uint32_t height, std::vector<uint32_t>& order,
+                           std::vector<uint32_t>& frontier);
+
+    uint32_t mWidth;
+    uint32_t mQuantizationBits;
+    uint32_t mDepth{ 1 };
+    bool mValid{ true };
+    std::vector<uint32_t> mNodes;
+};
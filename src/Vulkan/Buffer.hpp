@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <memory>
 #include <vulkan/vulkan.h>
 
@@ -40,52 +42,30 @@ public:
     Buffer(const std::shared_ptr<VulkanManager> &vulkanManager, const T *data,
            VkDeviceSize size, VkBufferUsageFlags usage)
         : mVulkanManager(vulkanManager), mSize(size) {
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(vulkanManager, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     stagingBuffer, stagingBufferMemory);
-
-        void *mappedData;
-        vkMapMemory(mVulkanManager->Device(), stagingBufferMemory, 0, size, 0,
-                    &mappedData);
-        memcpy(mappedData, data, static_cast<size_t>(size));
-        vkUnmapMemory(mVulkanManager->Device(), stagingBufferMemory);
-
         createBuffer(mVulkanManager, size,
                      usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mBuffer, mMemory);
 
-        copyBuffer(mVulkanManager, stagingBuffer, mBuffer, size);
-
-        mVulkanManager->WaitIdle();
-
-        vkDestroyBuffer(mVulkanManager->Device(), stagingBuffer, nullptr);
-        vkFreeMemory(mVulkanManager->Device(), stagingBufferMemory, nullptr);
+        mVulkanManager->Upload(mBuffer, 0, data, size);
     }
 
     ~Buffer() {
-        vkDestroyBuffer(mVulkanManager->Device(), mBuffer, nullptr);
-        vkFreeMemory(mVulkanManager->Device(), mMemory, nullptr);
+        destroyBuffer(mVulkanManager, mBuffer, mMemory);
     }
 
     /**
      * @brief Updates the buffer data at a specified offset.
      *
      * Note: The buffer must be created with the generic constructor that does
-     * not initialize the data.
+     * not initialize the data, in host visible memory.
      *
      * @param data Pointer to the data to copy into the buffer.
      * @param size Size of the data to copy in bytes.
      * @param offset Offset in the buffer where the data should be copied.
      */
     void UpdateData(const T *data, VkDeviceSize size, VkDeviceSize offset = 0) {
-        void *mappedData;
-        vkMapMemory(mVulkanManager->Device(), mMemory, offset, size, 0,
-                    &mappedData);
-        memcpy(mappedData, data, static_cast<size_t>(size));
-        vkUnmapMemory(mVulkanManager->Device(), mMemory);
+        memcpy(static_cast<std::byte *>(mMemory.Mapped) + offset, data,
+               static_cast<size_t>(size));
     }
 
     [[nodiscard]] inline VkBuffer GetBuffer() const { return mBuffer; }
@@ -93,7 +73,7 @@ public:
 
 private:
     VkBuffer mBuffer;
-    VkDeviceMemory mMemory;
+    Allocation mMemory;
     VkDeviceSize mSize;
     std::shared_ptr<VulkanManager> mVulkanManager;
 };
@@ -123,8 +103,7 @@ public:
     }
 
     ~UniformBuffer() {
-        vkDestroyBuffer(mVulkanManager->Device(), mBuffer, nullptr);
-        vkFreeMemory(mVulkanManager->Device(), mMemory, nullptr);
+        destroyBuffer(mVulkanManager, mBuffer, mMemory);
     }
 
     /**
@@ -133,11 +112,7 @@ public:
      * @param data Reference to the data to copy into the buffer.
      */
     void UpdateData(const T &data) {
-        void *mappedData;
-        vkMapMemory(mVulkanManager->Device(), mMemory, 0, mSize, 0,
-                    &mappedData);
-        memcpy(mappedData, &data, sizeof(T));
-        vkUnmapMemory(mVulkanManager->Device(), mMemory);
+        memcpy(mMemory.Mapped, &data, sizeof(T));
     }
 
     [[nodiscard]] inline VkBuffer Buffer() const { return mBuffer; }
@@ -145,45 +120,159 @@ public:
 
 private:
     VkBuffer mBuffer;
-    VkDeviceMemory mMemory;
+    Allocation mMemory;
     VkDeviceSize mSize;
     std::shared_ptr<VulkanManager> mVulkanManager;
 };
 
+/**
+ * @brief Template class for a Vulkan storage buffer.
+ *
+ * The buffer lives in device local memory and keeps its allocation across
+ * updates. It holds a number of elements in use, which is what gets bound,
+ * inside a capacity that only grows, so resizing within the capacity and
+ * rewriting parts of the elements never reallocates.
+ *
+ * Descriptors cannot have an empty range, so an empty buffer is bound with
+ * one element, which is zeroed when the buffer is created empty.
+ */
 template <typename T>
 class StorageBuffer {
 public:
-    StorageBuffer(const std::shared_ptr<VulkanManager> &vulkanManager, const T* data, size_t size)
-        : mVulkanManager(vulkanManager), mSize(sizeof(T) * size) {
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(vulkanManager, mSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     stagingBuffer, stagingBufferMemory);
+    // Largest update vkCmdUpdateBuffer accepts, larger ones go through a
+    // staging buffer.
+    static constexpr VkDeviceSize MAX_INLINE_UPDATE_SIZE = 65536;
 
-        void *mappedData;
-        vkMapMemory(mVulkanManager->Device(), stagingBufferMemory, 0, mSize, 0,
-                    &mappedData);
-        memcpy(mappedData, data, static_cast<size_t>(mSize));
-        vkUnmapMemory(mVulkanManager->Device(), stagingBufferMemory);
+    /**
+     * @brief Constructs a storage buffer and initializes it with the given
+     * elements.
+     *
+     * @param vulkanManager Shared pointer to the VulkanManager instance.
+     * @param data Pointer to the elements to initialize the buffer with.
+     * @param size Number of elements.
+     */
+    StorageBuffer(const std::shared_ptr<VulkanManager> &vulkanManager, const T* data, size_t size)
+        : StorageBuffer(vulkanManager, size) {
+        mSize = sizeof(T) * size;
+        if (mSize > 0) {
+            Upload(data, 0, size);
+        } else {
+            T placeholder{};
+            Upload(&placeholder, 0, 1);
+        }
+    }
 
-        createBuffer(mVulkanManager, mSize,
+    /**
+     * @brief Constructs an empty storage buffer with room for the given
+     * number of elements.
+     *
+     * @param vulkanManager Shared pointer to the VulkanManager instance.
+     * @param capacity Number of elements to allocate memory for.
+     */
+    StorageBuffer(const std::shared_ptr<VulkanManager> &vulkanManager, size_t capacity)
+        : mSize(0), mCapacity(sizeof(T) * std::max<size_t>(capacity, 1)),
+          mVulkanManager(vulkanManager) {
+        createBuffer(mVulkanManager, mCapacity,
                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mBuffer, mMemory);
+    }
 
-        copyBuffer(mVulkanManager, stagingBuffer, mBuffer, mSize);
+    ~StorageBuffer() {
+        destroyBuffer(mVulkanManager, mBuffer, mMemory);
+    }
 
-        mVulkanManager->WaitIdle();
+    /**
+     * @brief Sets the number of elements in use.
+     *
+     * Growing past the capacity reallocates the buffer with at least twice
+     * the capacity and copies the elements in use over. This waits for the
+     * device, since frames in flight may still read the old buffer.
+     *
+     * @return true if the buffer was reallocated, in which case it has to be
+     * bound again.
+     */
+    bool Resize(size_t size) {
+        VkDeviceSize newSize = sizeof(T) * size;
+        if (newSize <= mCapacity) {
+            mSize = newSize;
+            return false;
+        }
 
-        vkDestroyBuffer(mVulkanManager->Device(), stagingBuffer, nullptr);
-        vkFreeMemory(mVulkanManager->Device(), stagingBufferMemory, nullptr);
+        Reallocate(std::max(newSize, mCapacity * 2));
+        mSize = newSize;
+        return true;
     }
 
-    ~StorageBuffer() {
-        vkDestroyBuffer(mVulkanManager->Device(), mBuffer, nullptr);
-        vkFreeMemory(mVulkanManager->Device(), mMemory, nullptr);
+    /**
+     * @brief Moves the buffer out of a memory block the allocator is
+     * emptying, between MemoryAllocator::BeginDefragmentation and
+     * EndDefragmentation. Waits for the device like Resize.
+     *
+     * @return true if the buffer was moved, in which case it has to be bound
+     * again.
+     */
+    bool Relocate() {
+        if (!mVulkanManager->Allocator().ShouldRelocate(mMemory)) {
+            return false;
+        }
+
+        Reallocate(mCapacity);
+        return true;
+    }
+
+    /**
+     * @brief Records a write of elements in use into a command buffer.
+     *
+     * Small writes are embedded in the command buffer with vkCmdUpdateBuffer
+     * and are ordered against the compute shaders of the frames before and
+     * after it with barriers, so they cost no allocation and no stall. Writes
+     * larger than MAX_INLINE_UPDATE_SIZE go through the staging ring instead,
+     * whose copies are submitted ahead of the frame and wait for the frames
+     * before it.
+     *
+     * @param commandBuffer Command buffer being recorded, outside of a render
+     * pass.
+     * @param data Pointer to the elements to write.
+     * @param first Index of the first element to overwrite.
+     * @param count Number of elements to write.
+     */
+    void Update(VkCommandBuffer commandBuffer, const T* data, size_t first, size_t count) {
+        static_assert(sizeof(T) % 4 == 0, "vkCmdUpdateBuffer needs 4 byte aligned writes");
+
+        VkDeviceSize offset = sizeof(T) * first;
+        VkDeviceSize size = sizeof(T) * count;
+        if (size == 0) {
+            return;
+        }
+        if (size > MAX_INLINE_UPDATE_SIZE) {
+            Upload(data, first, count);
+            return;
+        }
+
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = mBuffer;
+        barrier.offset = offset;
+        barrier.size = size;
+
+        // Earlier frames may still be reading the range.
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                             &barrier, 0, nullptr);
+
+        vkCmdUpdateBuffer(commandBuffer, mBuffer, offset, size, data);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                             1, &barrier, 0, nullptr);
     }
 
     void CopyTo(const StorageBuffer<T>& dstBuffer, VkDeviceSize dstOffset = 0) {
@@ -192,10 +281,46 @@ public:
 
     [[nodiscard]] inline VkBuffer GetBuffer() const { return mBuffer; }
     [[nodiscard]] inline VkDeviceSize Size() const { return mSize; }
+    [[nodiscard]] inline VkDeviceSize Capacity() const { return mCapacity; }
 
 private:
+    /**
+     * @brief Moves the elements in use to a new buffer with the given
+     * capacity.
+     */
+    void Reallocate(VkDeviceSize capacity) {
+        VkBuffer newBuffer;
+        Allocation newMemory;
+        createBuffer(mVulkanManager, capacity,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newBuffer, newMemory);
+
+        mVulkanManager->WaitIdle();
+        // The element bound in place of an empty buffer moves along.
+        copyBuffer(mVulkanManager, mBuffer, newBuffer, std::max<VkDeviceSize>(mSize, sizeof(T)));
+
+        destroyBuffer(mVulkanManager, mBuffer, mMemory);
+        mBuffer = newBuffer;
+        mMemory = newMemory;
+        mCapacity = capacity;
+    }
+
+    /**
+     * @brief Queues a write of elements through the staging ring.
+     *
+     * Nothing is waited for, so buffers can be filled from other threads
+     * while frames are being rendered. The write lands before the next frame
+     * and before any copy out of the buffer.
+     */
+    void Upload(const T* data, size_t first, size_t count) {
+        mVulkanManager->Upload(mBuffer, sizeof(T) * first, data, sizeof(T) * count);
+    }
+
     VkBuffer mBuffer;
-    VkDeviceMemory mMemory;
+    Allocation mMemory;
     VkDeviceSize mSize;
+    VkDeviceSize mCapacity;
     std::shared_ptr<VulkanManager> mVulkanManager;
-};
\ No newline at end of file
+};
@@ -63,20 +63,13 @@ VkSampler createImageSampler(VkDevice device) {
     return imageSampler;
 }
 
-VkDeviceMemory allocateImageMemory(const std::shared_ptr<VulkanManager> &vulkanManager, VkImage image) {
+Allocation allocateImageMemory(const std::shared_ptr<VulkanManager> &vulkanManager, VkImage image) {
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(vulkanManager->Device(), image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType(vulkanManager->PhysicalDevice(), memRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    
-    VkDeviceMemory imageMemory;
-    VK_CHECK(vkAllocateMemory(vulkanManager->Device(), &allocInfo, nullptr, &imageMemory));
-    VK_CHECK(vkBindImageMemory(vulkanManager->Device(), image, imageMemory, 0));
+    Allocation imageMemory = vulkanManager->Allocator().Allocate(
+        memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+    VK_CHECK(vkBindImageMemory(vulkanManager->Device(), image, imageMemory.Memory, imageMemory.Offset));
 
     return imageMemory;
 }
@@ -95,8 +88,8 @@ Image::Image(const std::shared_ptr<VulkanManager> &vulkanManager,
 }
 
 Image::~Image() {
-    vkFreeMemory(mVulkanManager->Device(), mImageMemory, nullptr);
     vkDestroyImage(mVulkanManager->Device(), mImage, nullptr);
+    mVulkanManager->Allocator().Free(mImageMemory);
     vkDestroyImageView(mVulkanManager->Device(), mImageView, nullptr);
     vkDestroySampler(mVulkanManager->Device(), mSampler, nullptr);
 }
@@ -37,6 +37,6 @@ private:
     VkImageLayout mLayout;
     VkImageUsageFlags mUsage;
     VkFormat mFormat;
-    VkDeviceMemory mImageMemory;
+    Allocation mImageMemory;
 
 };
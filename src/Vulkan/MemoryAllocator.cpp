@@ -0,0 +1,274 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "Core/Logger.h"
+#include "Vulkan/Utils.h"
+
+constexpr uint32_t ORDER_COUNT =
+    std::countr_zero(MemoryAllocator::BLOCK_SIZE) - std::countr_zero(MemoryAllocator::MIN_ALLOCATION_SIZE) + 1;
+
+MemoryAllocator::MemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device)
+    : mPhysicalDevice(physicalDevice), mDevice(device) {
+    vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &mMemoryProperties);
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    for (auto& [key, blocks] : mPools) {
+        for (auto& block : blocks) {
+            if (block->AllocationCount > 0) {
+                LOG_WARNING("Releasing a memory block with {} allocations left", block->AllocationCount);
+            }
+            vkFreeMemory(mDevice, block->Memory, nullptr);
+        }
+    }
+    if (mDedicatedCount > 0) {
+        LOG_WARNING("{} dedicated allocations were never freed", mDedicatedCount);
+    }
+}
+
+Allocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements,
+                                     VkMemoryPropertyFlags properties, bool linear) {
+    uint32_t memoryType = findMemoryType(mPhysicalDevice, requirements.memoryTypeBits, properties);
+    if (memoryType == UINT32_MAX) {
+        LOG_WARNING("No memory type supports the requested properties");
+        return {};
+    }
+
+    // A range of a power of two size is aligned to its size, which covers
+    // the power of two alignments Vulkan requires.
+    VkDeviceSize size = std::bit_ceil(std::max({ requirements.size, requirements.alignment, MIN_ALLOCATION_SIZE }));
+
+    Allocation allocation;
+    if (size > BLOCK_SIZE / 2) {
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = requirements.size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+            LOG_WARNING("Failed to allocate {} bytes of device memory", requirements.size);
+            return {};
+        }
+
+        allocation.Memory = memory;
+        allocation.Size = requirements.size;
+        allocation.Mapped = Map(memory, memoryType);
+
+        std::lock_guard lock(mMutex);
+        mDedicatedCount++;
+        mDedicatedBytes += allocation.Size;
+        return allocation;
+    }
+
+    uint32_t order = std::countr_zero(BLOCK_SIZE) - std::countr_zero(size);
+
+    std::lock_guard lock(mMutex);
+    MemoryBlock* block = nullptr;
+    VkDeviceSize offset = 0;
+    for (auto& candidate : mPools[{ memoryType, linear }]) {
+        if (!candidate->Evacuating && AllocateRange(*candidate, order, offset)) {
+            block = candidate.get();
+            break;
+        }
+    }
+
+    if (!block) {
+        block = CreateBlock(memoryType, linear);
+        if (!block) {
+            return {};
+        }
+        AllocateRange(*block, order, offset);
+    }
+
+    allocation.Memory = block->Memory;
+    allocation.Offset = offset;
+    allocation.Size = size;
+    allocation.Mapped = block->Mapped ? block->Mapped + offset : nullptr;
+    allocation.Block = block;
+    allocation.Order = order;
+    return allocation;
+}
+
+void MemoryAllocator::Free(Allocation& allocation) {
+    if (allocation.Memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    if (!allocation.Block) {
+        // Freeing mapped memory unmaps it.
+        vkFreeMemory(mDevice, allocation.Memory, nullptr);
+
+        std::lock_guard lock(mMutex);
+        mDedicatedCount--;
+        mDedicatedBytes -= allocation.Size;
+        allocation = {};
+        return;
+    }
+
+    std::lock_guard lock(mMutex);
+    MemoryBlock* block = allocation.Block;
+    FreeRange(*block, allocation.Order, allocation.Offset);
+
+    // One empty block is kept per pool, so a scene rebuild freeing and
+    // allocating its buffers again does not go back to the driver.
+    auto& blocks = mPools[{ block->MemoryType, block->Linear }];
+    if (block->AllocationCount == 0 && (blocks.size() > 1 || block->Evacuating)) {
+        ReleaseBlock(block);
+    }
+    allocation = {};
+}
+
+uint32_t MemoryAllocator::BeginDefragmentation() {
+    std::lock_guard lock(mMutex);
+    uint32_t picked = 0;
+    for (auto& [key, blocks] : mPools) {
+        if (blocks.size() < 2) {
+            continue;
+        }
+
+        auto leastUsed = std::min_element(blocks.begin(), blocks.end(), [](const auto& a, const auto& b) {
+            return a->UsedBytes < b->UsedBytes;
+        });
+
+        VkDeviceSize freeBytes = 0;
+        for (const auto& block : blocks) {
+            if (block != *leastUsed) {
+                freeBytes += BLOCK_SIZE - block->UsedBytes;
+            }
+        }
+
+        if ((*leastUsed)->UsedBytes < BLOCK_SIZE / 2 && (*leastUsed)->UsedBytes <= freeBytes) {
+            (*leastUsed)->Evacuating = true;
+            picked++;
+        }
+    }
+    return picked;
+}
+
+bool MemoryAllocator::ShouldRelocate(const Allocation& allocation) const {
+    std::lock_guard lock(mMutex);
+    return allocation.Block && allocation.Block->Evacuating;
+}
+
+void MemoryAllocator::EndDefragmentation() {
+    std::lock_guard lock(mMutex);
+    for (auto& [key, blocks] : mPools) {
+        // A picked block that was empty to begin with never sees a range
+        // freed, so it is released here.
+        std::erase_if(blocks, [this](const auto& block) {
+            if (block->Evacuating && block->AllocationCount == 0) {
+                vkFreeMemory(mDevice, block->Memory, nullptr);
+                return true;
+            }
+            block->Evacuating = false;
+            return false;
+        });
+    }
+}
+
+MemoryAllocator::Stats MemoryAllocator::GetStats() const {
+    std::lock_guard lock(mMutex);
+    Stats stats{};
+    stats.DedicatedCount = mDedicatedCount;
+    stats.AllocationCount = mDedicatedCount;
+    stats.ReservedBytes = mDedicatedBytes;
+    stats.UsedBytes = mDedicatedBytes;
+    for (const auto& [key, blocks] : mPools) {
+        for (const auto& block : blocks) {
+            stats.BlockCount++;
+            stats.AllocationCount += block->AllocationCount;
+            stats.ReservedBytes += BLOCK_SIZE;
+            stats.UsedBytes += block->UsedBytes;
+        }
+    }
+    return stats;
+}
+
+MemoryBlock* MemoryAllocator::CreateBlock(uint32_t memoryType, bool linear) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = BLOCK_SIZE;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        LOG_WARNING("Failed to allocate a {} MiB memory block", BLOCK_SIZE >> 20);
+        return nullptr;
+    }
+
+    auto block = std::make_unique<MemoryBlock>();
+    block->Memory = memory;
+    block->Mapped = static_cast<std::byte*>(Map(memory, memoryType));
+    block->MemoryType = memoryType;
+    block->Linear = linear;
+    block->FreeLists.resize(ORDER_COUNT);
+    block->FreeLists[0].insert(0);
+    block->UsedBytes = 0;
+    block->AllocationCount = 0;
+    block->Evacuating = false;
+
+    auto& blocks = mPools[{ memoryType, linear }];
+    blocks.push_back(std::move(block));
+    LOG_DEBUG("Allocated memory block {} of memory type {}", blocks.size(), memoryType);
+    return blocks.back().get();
+}
+
+void MemoryAllocator::ReleaseBlock(MemoryBlock* block) {
+    vkFreeMemory(mDevice, block->Memory, nullptr);
+    std::erase_if(mPools[{ block->MemoryType, block->Linear }],
+                  [block](const auto& candidate) { return candidate.get() == block; });
+}
+
+bool MemoryAllocator::AllocateRange(MemoryBlock& block, uint32_t order, VkDeviceSize& offset) {
+    // Finds the smallest free range that is large enough.
+    uint32_t available = order + 1;
+    while (available > 0 && block.FreeLists[available - 1].empty()) {
+        available--;
+    }
+    if (available == 0) {
+        return false;
+    }
+
+    auto& freeList = block.FreeLists[available - 1];
+    offset = *freeList.begin();
+    freeList.erase(freeList.begin());
+
+    // Halves the range until it has the requested size, the upper halves
+    // staying free.
+    for (uint32_t split = available; split <= order; split++) {
+        block.FreeLists[split].insert(offset + (BLOCK_SIZE >> split));
+    }
+
+    block.UsedBytes += BLOCK_SIZE >> order;
+    block.AllocationCount++;
+    return true;
+}
+
+void MemoryAllocator::FreeRange(MemoryBlock& block, uint32_t order, VkDeviceSize offset) {
+    block.UsedBytes -= BLOCK_SIZE >> order;
+    block.AllocationCount--;
+
+    // Merges the range with its buddy for as long as the buddy is free.
+    while (order > 0) {
+        VkDeviceSize buddy = offset ^ (BLOCK_SIZE >> order);
+        if (block.FreeLists[order].erase(buddy) == 0) {
+            break;
+        }
+        offset = std::min(offset, buddy);
+        order--;
+    }
+    block.FreeLists[order].insert(offset);
+}
+
+void* MemoryAllocator::Map(VkDeviceMemory memory, uint32_t memoryType) const {
+    if (!(mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        return nullptr;
+    }
+
+    void* mapped = nullptr;
+    VK_CHECK(vkMapMemory(mDevice, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+    return mapped;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief Device memory allocation the MemoryAllocator splits into ranges.
+ */
+struct MemoryBlock {
+    VkDeviceMemory Memory;
+    // Start of the whole block for host visible memory, nullptr otherwise.
+    std::byte* Mapped;
+    uint32_t MemoryType;
+    bool Linear;
+    // Offsets of the free ranges of each order, where the range of order n
+    // covers BLOCK_SIZE >> n bytes.
+    std::vector<std::set<VkDeviceSize>> FreeLists;
+    VkDeviceSize UsedBytes;
+    uint32_t AllocationCount;
+    // Set while a defragmentation pass empties the block, which then takes no
+    // new allocations.
+    bool Evacuating;
+};
+
+/**
+ * @brief Range of device memory a resource is bound to.
+ */
+struct Allocation {
+    VkDeviceMemory Memory = VK_NULL_HANDLE;
+    VkDeviceSize Offset = 0;
+    VkDeviceSize Size = 0;
+    // Start of the range for host visible memory, which stays mapped for as
+    // long as it is allocated, nullptr otherwise.
+    void* Mapped = nullptr;
+
+    // Block the range was taken from, nullptr for a dedicated allocation.
+    MemoryBlock* Block = nullptr;
+    uint32_t Order = 0;
+};
+
+/**
+ * @brief Sub-allocates buffers and images from a few large device memory
+ * blocks instead of allocating memory for every resource.
+ *
+ * Every memory type gets its own pools of blocks, one for buffers and one
+ * for optimally tiled images, so neighbouring linear and non-linear resources
+ * never have to respect bufferImageGranularity. Blocks are split with a buddy
+ * allocator: sizes are rounded up to a power of two no smaller than the
+ * alignment, so every range is naturally aligned, and freed ranges merge back
+ * with their buddy in constant time per order. Resources larger than half a
+ * block get a dedicated allocation.
+ *
+ * Host visible blocks are mapped once when they are allocated, since memory
+ * cannot be mapped twice; Allocation::Mapped points into that mapping.
+ *
+ * All methods can be called from any thread.
+ */
+class MemoryAllocator {
+public:
+    static constexpr VkDeviceSize BLOCK_SIZE = 64ull << 20;
+    static constexpr VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+
+    struct Stats {
+        uint32_t BlockCount;
+        uint32_t DedicatedCount;
+        uint32_t AllocationCount;
+        // Device memory allocated from the driver, for blocks and dedicated
+        // allocations.
+        VkDeviceSize ReservedBytes;
+        // Memory handed out to resources, including the rounding of their
+        // sizes.
+        VkDeviceSize UsedBytes;
+    };
+
+    MemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    /**
+     * @brief Allocates memory for a resource.
+     *
+     * @param requirements Memory requirements of the resource.
+     * @param properties Properties the memory type must have.
+     * @param linear Whether the resource is a buffer or a linearly tiled
+     * image rather than an optimally tiled image.
+     * @return An empty allocation if the memory could not be allocated.
+     */
+    [[nodiscard]] Allocation Allocate(const VkMemoryRequirements& requirements,
+                                      VkMemoryPropertyFlags properties, bool linear);
+
+    /**
+     * @brief Returns the memory of an allocation and resets it. Freeing an
+     * empty allocation does nothing.
+     */
+    void Free(Allocation& allocation);
+
+    /**
+     * @brief Starts a defragmentation pass by picking the blocks to empty.
+     *
+     * The least used block of a pool is picked when less than half of it is
+     * in use and the other blocks of the pool have room for its ranges.
+     * Picked blocks take no new allocations until EndDefragmentation, so the
+     * owners of the allocations ShouldRelocate returns true for can move them
+     * by allocating again and copying their contents over. A block is
+     * released as soon as its last range is freed.
+     *
+     * @return Number of blocks picked.
+     */
+    uint32_t BeginDefragmentation();
+    [[nodiscard]] bool ShouldRelocate(const Allocation& allocation) const;
+    void EndDefragmentation();
+
+    [[nodiscard]] Stats GetStats() const;
+
+private:
+    using PoolKey = std::pair<uint32_t, bool>;
+
+    MemoryBlock* CreateBlock(uint32_t memoryType, bool linear);
+    void ReleaseBlock(MemoryBlock* block);
+    static bool AllocateRange(MemoryBlock& block, uint32_t order, VkDeviceSize& offset);
+    static void FreeRange(MemoryBlock& block, uint32_t order, VkDeviceSize offset);
+    void* Map(VkDeviceMemory memory, uint32_t memoryType) const;
+
+    VkPhysicalDevice mPhysicalDevice;
+    VkDevice mDevice;
+    VkPhysicalDeviceMemoryProperties mMemoryProperties;
+
+    std::map<PoolKey, std::vector<std::unique_ptr<MemoryBlock>>> mPools;
+    uint32_t mDedicatedCount{ 0 };
+    VkDeviceSize mDedicatedBytes{ 0 };
+    mutable std::mutex mMutex;
+};
@@ -180,9 +180,27 @@ VkPipeline createGraphicsPipeline(
 }
 
 VkPipeline createComputePipeline(VkDevice device, VkPipelineLayout layout,
-                                 const std::shared_ptr<Shader> &computeShader) {
+                                 const std::shared_ptr<Shader> &computeShader,
+                                 const std::vector<uint32_t> &specializationConstants) {
+    // Constant i of the vector is bound to constant_id i in the shader.
+    std::vector<VkSpecializationMapEntry> mapEntries(specializationConstants.size());
+    for (uint32_t i = 0; i < mapEntries.size(); i++) {
+        mapEntries[i].constantID = i;
+        mapEntries[i].offset = i * sizeof(uint32_t);
+        mapEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+    specializationInfo.pMapEntries = mapEntries.data();
+    specializationInfo.dataSize = specializationConstants.size() * sizeof(uint32_t);
+    specializationInfo.pData = specializationConstants.data();
+
     VkPipelineShaderStageCreateInfo shaderStage =
         computeShader->CreateShaderStageInfo();
+    if (!specializationConstants.empty()) {
+        shaderStage.pSpecializationInfo = &specializationInfo;
+    }
 
     VkComputePipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -227,12 +245,13 @@ void Pipeline::Bind(const std::shared_ptr<CommandBuffer> &commandBuffer) {
 
 ComputePipeline::ComputePipeline(
     const std::shared_ptr<VulkanManager> &vulkanManager,
-    const std::shared_ptr<Shader> &computeShader)
+    const std::shared_ptr<Shader> &computeShader,
+    const std::vector<uint32_t> &specializationConstants)
     : mVulkanManager(vulkanManager), mComputeShader(computeShader) {
     mLayout = createPipelineLayout(mVulkanManager->Device(),
                                    mComputeShader->DescriptorSetLayout(0));
     mPipeline = createComputePipeline(mVulkanManager->Device(), mLayout,
-                                      mComputeShader);
+                                      mComputeShader, specializationConstants);
 }
 
 ComputePipeline::~ComputePipeline() {
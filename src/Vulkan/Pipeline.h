@@ -37,9 +37,12 @@ public:
      *
      * @param vulkanManager Shared pointer to the VulkanManager instance.
      * @param computeShader Shared pointer to the compute Shader instance.
+     * @param specializationConstants Values of the 32-bit specialization
+     * constants, the value at index i is bound to constant_id i.
      */
     ComputePipeline(const std::shared_ptr<VulkanManager> &vulkanManager,
-                    const std::shared_ptr<Shader> &computeShader);
+                    const std::shared_ptr<Shader> &computeShader,
+                    const std::vector<uint32_t> &specializationConstants = {});
     ~ComputePipeline();
 
     /**
@@ -33,9 +33,13 @@ VkShaderStageFlagBits getVulkanShaderStage(ShaderStage stage) {
 }
 
 std::vector<uint32_t> compileShader(const std::string &filename,
-                                    shaderc_shader_kind kind) {
+                                    shaderc_shader_kind kind,
+                                    const std::map<std::string, std::string> &defines) {
     shaderc::Compiler compiler;
     shaderc::CompileOptions options;
+    for (const auto &[name, value] : defines) {
+        options.AddMacroDefinition(name, value);
+    }
 
     std::ifstream file(filename);
     if (!file.is_open()) {
@@ -200,8 +204,9 @@ void createDescriptorSet(VkDevice device, const std::vector<uint32_t> &bytecode,
 
 Shader *Shader::Create(const std::shared_ptr<VulkanManager> &vulkanManager,
                        const std::string &filename, ShaderStage stage,
-                       uint32_t setCount) {
-    auto *shader = new Shader(vulkanManager, filename, stage, setCount);
+                       uint32_t setCount,
+                       const std::map<std::string, std::string> &defines) {
+    auto *shader = new Shader(vulkanManager, filename, stage, setCount, defines);
     if (shader->mShader == VK_NULL_HANDLE) {
         return nullptr;
     }
@@ -211,9 +216,10 @@ Shader *Shader::Create(const std::shared_ptr<VulkanManager> &vulkanManager,
 
 Shader::Shader(const std::shared_ptr<VulkanManager> &vulkanManager,
                const std::string &filename, ShaderStage stage,
-               uint32_t setCount)
+               uint32_t setCount,
+               const std::map<std::string, std::string> &defines)
     : mVulkanManager(vulkanManager), mStage(getVulkanShaderStage(stage)) {
-    auto spirv = compileShader(filename, getShaderKind(stage));
+    auto spirv = compileShader(filename, getShaderKind(stage), defines);
     if (spirv.empty()) {
         return;
     }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <string>
@@ -35,12 +36,14 @@ public:
      * @param filename Path to the GLSL source file.
      * @param stage Shader stage (Vertex, Fragment, Compute).
      * @param setCount Number of descriptor sets used by the shader.
+     * @param defines Preprocessor macros defined before compiling the source.
      * @return Pointer to the created Shader instance (or nullptr on compilation
      * error).
      */
     static Shader *Create(const std::shared_ptr<VulkanManager> &vulkanManager,
                           const std::string &filename, ShaderStage stage,
-                          uint32_t setCount);
+                          uint32_t setCount,
+                          const std::map<std::string, std::string> &defines = {});
     ~Shader();
 
     [[nodiscard]] inline VkDescriptorSetLayout
@@ -69,7 +72,8 @@ public:
         VkDescriptorBufferInfo bufferInfo = {};
         bufferInfo.buffer = buffer.GetBuffer();
         bufferInfo.offset = 0;
-        bufferInfo.range = buffer.Size();
+        // A zero range is invalid, see StorageBuffer.
+        bufferInfo.range = std::max<VkDeviceSize>(buffer.Size(), sizeof(T));
 
         VkWriteDescriptorSet descriptorWrite = {};
         descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -207,7 +211,8 @@ public:
 
 private:
     Shader(const std::shared_ptr<VulkanManager> &vulkanManager,
-           const std::string &filename, ShaderStage stage, uint32_t setCount);
+           const std::string &filename, ShaderStage stage, uint32_t setCount,
+           const std::map<std::string, std::string> &defines);
 
     std::shared_ptr<VulkanManager> mVulkanManager;
 
@@ -0,0 +1,185 @@
+#include "StagingRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Vulkan/VulkanManager.h"
+
+// Staged ranges start on this alignment so the copies read aligned memory.
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+StagingRing::StagingRing(VulkanManager& vulkanManager)
+    : mVulkanManager(vulkanManager) {
+    VkDevice device = mVulkanManager.Device();
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = PARTITION_SIZE * PARTITION_COUNT;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkCreateBuffer(device, &bufferInfo, nullptr, &mBuffer));
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, mBuffer, &memRequirements);
+    mMemory = mVulkanManager.Allocator().Allocate(
+        memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+    VK_CHECK(vkBindBufferMemory(device, mBuffer, mMemory.Memory, mMemory.Offset));
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = mVulkanManager.GraphicsQueue().familyIndex;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &mCommandPool));
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = mCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    mPartitions.resize(PARTITION_COUNT);
+    for (auto& partition : mPartitions) {
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &partition.CommandBuffer));
+        VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &partition.Fence));
+        partition.Submitted = false;
+        partition.Used = 0;
+    }
+}
+
+StagingRing::~StagingRing() {
+    VkDevice device = mVulkanManager.Device();
+    for (auto& partition : mPartitions) {
+        if (partition.Submitted) {
+            VK_CHECK(vkWaitForFences(device, 1, &partition.Fence, VK_TRUE, UINT64_MAX));
+        }
+        vkDestroyFence(device, partition.Fence, nullptr);
+    }
+    vkDestroyCommandPool(device, mCommandPool, nullptr);
+    vkDestroyBuffer(device, mBuffer, nullptr);
+    mVulkanManager.Allocator().Free(mMemory);
+}
+
+void StagingRing::Upload(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+    const auto* bytes = static_cast<const std::byte*>(data);
+
+    std::lock_guard lock(mMutex);
+
+    // The regions of a copy command must not overlap, so a range written
+    // again before the flush goes into the next batch.
+    const auto& copies = mPartitions[mCurrent].Copies;
+    if (std::any_of(copies.begin(), copies.end(), [&](const Copy& copy) {
+            return copy.Buffer == buffer && copy.Region.dstOffset < offset + size &&
+                   offset < copy.Region.dstOffset + copy.Region.size;
+        })) {
+        FlushLocked();
+    }
+
+    while (size > 0) {
+        if (mPartitions[mCurrent].Used == PARTITION_SIZE) {
+            FlushLocked();
+        }
+
+        Partition* partition = &mPartitions[mCurrent];
+        VkDeviceSize chunk = std::min(size, PARTITION_SIZE - partition->Used);
+        VkDeviceSize stagingOffset = mCurrent * PARTITION_SIZE + partition->Used;
+        std::memcpy(static_cast<std::byte*>(mMemory.Mapped) + stagingOffset, bytes, static_cast<size_t>(chunk));
+        partition->Copies.push_back({ buffer, { stagingOffset, offset, chunk } });
+        partition->Used = std::min(PARTITION_SIZE, (partition->Used + chunk + STAGING_ALIGNMENT - 1) &
+                                                       ~(STAGING_ALIGNMENT - 1));
+
+        bytes += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+void StagingRing::Cancel(VkBuffer buffer) {
+    std::lock_guard lock(mMutex);
+
+    Partition& partition = mPartitions[mCurrent];
+    std::erase_if(partition.Copies, [buffer](const Copy& copy) { return copy.Buffer == buffer; });
+    // A flush without copies submits nothing, so it would never free a full
+    // partition again.
+    if (partition.Copies.empty()) {
+        partition.Used = 0;
+    }
+}
+
+void StagingRing::Flush() {
+    std::lock_guard lock(mMutex);
+    FlushLocked();
+}
+
+void StagingRing::FlushLocked() {
+    Partition& partition = mPartitions[mCurrent];
+    if (partition.Copies.empty()) {
+        return;
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkResetCommandBuffer(partition.CommandBuffer, 0);
+    vkBeginCommandBuffer(partition.CommandBuffer, &beginInfo);
+
+    // Frames still in flight may be reading the ranges being overwritten,
+    // which only needs an execution dependency.
+    vkCmdPipelineBarrier(partition.CommandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    // Regions are grouped by destination, so each buffer takes one copy
+    // command.
+    std::stable_sort(partition.Copies.begin(), partition.Copies.end(),
+                     [](const Copy& a, const Copy& b) { return a.Buffer < b.Buffer; });
+    std::vector<VkBufferCopy> regions;
+    for (size_t first = 0; first < partition.Copies.size();) {
+        VkBuffer buffer = partition.Copies[first].Buffer;
+        regions.clear();
+        size_t last = first;
+        for (; last < partition.Copies.size() && partition.Copies[last].Buffer == buffer; last++) {
+            regions.push_back(partition.Copies[last].Region);
+        }
+        vkCmdCopyBuffer(partition.CommandBuffer, mBuffer, buffer, static_cast<uint32_t>(regions.size()),
+                        regions.data());
+        first = last;
+    }
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                            VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(partition.CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(partition.CommandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &partition.CommandBuffer;
+    {
+        auto queueLock = mVulkanManager.LockQueues();
+        VK_CHECK(vkQueueSubmit(mVulkanManager.GraphicsQueue().queue, 1, &submitInfo, partition.Fence));
+    }
+    partition.Submitted = true;
+
+    mCurrent = (mCurrent + 1) % PARTITION_COUNT;
+    Reuse(mPartitions[mCurrent]);
+}
+
+void StagingRing::Reuse(Partition& partition) {
+    if (partition.Submitted) {
+        VkDevice device = mVulkanManager.Device();
+        VK_CHECK(vkWaitForFences(device, 1, &partition.Fence, VK_TRUE, UINT64_MAX));
+        VK_CHECK(vkResetFences(device, 1, &partition.Fence));
+        partition.Submitted = false;
+    }
+    partition.Used = 0;
+    partition.Copies.clear();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "Vulkan/MemoryAllocator.h"
+
+class VulkanManager;
+
+/**
+ * @brief Persistently mapped staging buffer every upload to device local
+ * memory goes through.
+ *
+ * The ring is split into partitions. Uploads copy their data into the
+ * current partition and queue a copy into their destination; a flush
+ * submits all queued copies as one command buffer and moves on to the next
+ * partition. A partition is only written again once the fence of its last
+ * submission signalled, so uploads never allocate, map or wait for the
+ * device, unless they outrun the whole ring. Uploads larger than a
+ * partition are split over several.
+ *
+ * Copies are surrounded by barriers that cover every submission before and
+ * after them on the queue: they wait for earlier shaders to stop reading
+ * their destinations and finish before later shaders or transfers read them.
+ */
+class StagingRing {
+public:
+    static constexpr uint32_t PARTITION_COUNT = 4;
+    static constexpr VkDeviceSize PARTITION_SIZE = 8ull << 20;
+
+    explicit StagingRing(VulkanManager& vulkanManager);
+    ~StagingRing();
+
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    /**
+     * @brief Copies data into the ring and queues its copy into a buffer.
+     *
+     * The destination must stay alive until the upload has finished on the
+     * device, or be passed to Cancel before it is destroyed.
+     */
+    void Upload(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+    /**
+     * @brief Drops the copies into a buffer that were not flushed yet, so the
+     * buffer can be destroyed.
+     *
+     * Flushed copies are not affected: buffers are only destroyed once the
+     * frames in flight that could still be reading them completed, and those
+     * frames were submitted after the copies.
+     */
+    void Cancel(VkBuffer buffer);
+
+    /**
+     * @brief Submits the copies queued since the last flush, if any, without
+     * waiting for them.
+     */
+    void Flush();
+
+private:
+    struct Copy {
+        VkBuffer Buffer;
+        VkBufferCopy Region;
+    };
+
+    struct Partition {
+        VkCommandBuffer CommandBuffer;
+        VkFence Fence;
+        // Whether the fence belongs to a submission that was not waited for.
+        bool Submitted;
+        VkDeviceSize Used;
+        std::vector<Copy> Copies;
+    };
+
+    void FlushLocked();
+    /**
+     * @brief Waits for the last submission of a partition and empties it.
+     */
+    void Reuse(Partition& partition);
+
+    VulkanManager& mVulkanManager;
+
+    VkBuffer mBuffer;
+    Allocation mMemory;
+    VkCommandPool mCommandPool;
+    std::vector<Partition> mPartitions;
+    // Partition uploads are written to, which never has a submission
+    // pending.
+    uint32_t mCurrent{ 0 };
+    std::mutex mMutex;
+};
@@ -240,6 +240,7 @@ void Surface::SubmitCommandBuffer(
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &cmdBuffer;
 
+    auto queueLock = mVulkanManager->LockQueues();
     VK_CHECK(vkQueueSubmit(mVulkanManager->GraphicsQueue().queue, 1, &submitInfo,
                            mInFlightFences[mCurrentFrame]));
 
@@ -19,7 +19,7 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
 void createBuffer(const std::shared_ptr<VulkanManager> &vulkanManager,
                   VkDeviceSize size, VkBufferUsageFlags usage,
                   VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                  VkDeviceMemory &bufferMemory) {
+                  Allocation &bufferMemory) {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
@@ -33,17 +33,18 @@ void createBuffer(const std::shared_ptr<VulkanManager> &vulkanManager,
     vkGetBufferMemoryRequirements(vulkanManager->Device(), buffer,
                                   &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType(vulkanManager->PhysicalDevice(),
-                       memRequirements.memoryTypeBits, properties);
+    bufferMemory = vulkanManager->Allocator().Allocate(memRequirements,
+                                                       properties, true);
+    VK_CHECK(vkBindBufferMemory(vulkanManager->Device(), buffer,
+                                bufferMemory.Memory, bufferMemory.Offset));
+}
 
-    VK_CHECK(vkAllocateMemory(vulkanManager->Device(), &allocInfo, nullptr,
-                              &bufferMemory));
-    VK_CHECK(
-        vkBindBufferMemory(vulkanManager->Device(), buffer, bufferMemory, 0));
+void destroyBuffer(const std::shared_ptr<VulkanManager> &vulkanManager,
+                   VkBuffer buffer, Allocation &bufferMemory) {
+    // A later buffer may get the same handle and receive the copies.
+    vulkanManager->CancelUploads(buffer);
+    vkDestroyBuffer(vulkanManager->Device(), buffer, nullptr);
+    vulkanManager->Allocator().Free(bufferMemory);
 }
 
 void copyBuffer(const std::shared_ptr<VulkanManager> &vulkanManager,
@@ -11,7 +11,10 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
 void createBuffer(const std::shared_ptr<VulkanManager>& vulkanManager,
                   VkDeviceSize size, VkBufferUsageFlags usage,
                   VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                  VkDeviceMemory &bufferMemory);
+                  Allocation &bufferMemory);
+
+void destroyBuffer(const std::shared_ptr<VulkanManager> &vulkanManager,
+                   VkBuffer buffer, Allocation &bufferMemory);
 
 void copyBuffer(const std::shared_ptr<VulkanManager> &vulkanManager,
                 VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
@@ -317,16 +317,26 @@ VulkanManager::VulkanManager(Window &window) {
 #endif
     mPhysicalDevice = choosePhysicalDevice(mInstance);
     mDevice = createDevice(mPhysicalDevice, layers, deviceExtensions, mGraphicsQueue, mComputeQueue);
+    mAllocator = std::make_unique<MemoryAllocator>(mPhysicalDevice, mDevice);
 
     mCommandPool = createCommandPool(mDevice, 0);
     mCommandBuffer = createCommandBuffer(mDevice, mCommandPool);
 
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VK_CHECK(vkCreateFence(mDevice, &fenceInfo, nullptr, &mCommandFence));
+
+    mStaging = std::make_unique<StagingRing>(*this);
+
     LOG_INFO("VulkanManager initialized successfully");
 }
 
 VulkanManager::~VulkanManager() {
+    mStaging.reset();
+    vkDestroyFence(mDevice, mCommandFence, nullptr);
     vkFreeCommandBuffers(mDevice, mCommandPool, 1, &mCommandBuffer);
     vkDestroyCommandPool(mDevice, mCommandPool, nullptr);
+    mAllocator.reset();
     vkDestroyDevice(mDevice, nullptr);
 
 #ifndef NDEBUG
@@ -337,6 +347,9 @@ VulkanManager::~VulkanManager() {
 }
 
 void VulkanManager::SubmitCommand(std::function<void(VkCommandBuffer)> func, bool graphics) {
+    FlushUploads();
+
+    std::lock_guard commandLock(mCommandMutex);
     vkResetCommandPool(mDevice, mCommandPool, 0);
 
     VkCommandBufferBeginInfo beginInfo{};
@@ -354,8 +367,21 @@ void VulkanManager::SubmitCommand(std::function<void(VkCommandBuffer)> func, boo
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &mCommandBuffer;
 
-    vkQueueSubmit(graphics ? mGraphicsQueue.queue : mComputeQueue.queue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphics ? mGraphicsQueue.queue : mComputeQueue.queue);
+    {
+        auto queueLock = LockQueues();
+        VK_CHECK(vkQueueSubmit(graphics ? mGraphicsQueue.queue : mComputeQueue.queue, 1,
+                               &submitInfo, mCommandFence));
+    }
+
+    // Waiting on the fence instead of the queue lets other threads keep
+    // submitting in the meantime.
+    VK_CHECK(vkWaitForFences(mDevice, 1, &mCommandFence, VK_TRUE, UINT64_MAX));
+    VK_CHECK(vkResetFences(mDevice, 1, &mCommandFence));
 }
 
-void VulkanManager::WaitIdle() const { vkDeviceWaitIdle(mDevice); }
+void VulkanManager::WaitIdle() const {
+    FlushUploads();
+
+    auto queueLock = LockQueues();
+    vkDeviceWaitIdle(mDevice);
+}
@@ -1,11 +1,15 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <vulkan/vk_enum_string_helper.h>
 #include <vulkan/vulkan.h>
 
 #include "Core/Logger.h"
 #include "Core/Window.h"
+#include "Vulkan/MemoryAllocator.h"
+#include "Vulkan/StagingRing.h"
 
 /**
  * @brief Macro to check the result of Vulkan function calls.
@@ -49,25 +53,73 @@ public:
     [[nodiscard]] inline Queue GraphicsQueue() const { return mGraphicsQueue; }
     [[nodiscard]] inline Queue ComputeQueue() const { return mComputeQueue; }
     /**
-     * @brief Waits for the device to finish all operations.
+     * @brief Allocator every buffer and image takes its memory from.
+     */
+    [[nodiscard]] inline MemoryAllocator& Allocator() const { return *mAllocator; }
+    /**
+     * @brief Flushes the queued uploads and waits for the device to finish
+     * all operations.
      */
     void WaitIdle() const;
     /**
-     * @brief Instantly submits commands to the device.
+     * @brief Writes data into a device local buffer through the staging
+     * ring.
+     *
+     * The data is copied right away and can be released on return, the copy
+     * into the buffer is queued until the next FlushUploads. Can be called
+     * from any thread.
+     */
+    void Upload(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+        mStaging->Upload(buffer, offset, data, size);
+    }
+    /**
+     * @brief Submits the queued uploads as one batch, ordered before every
+     * later submission.
+     *
+     * Called once per frame before the frame is submitted. SubmitCommand and
+     * WaitIdle flush as well, so their commands see every earlier upload.
+     */
+    void FlushUploads() const { mStaging->Flush(); }
+    /**
+     * @brief Drops the queued uploads into a buffer about to be destroyed.
+     */
+    void CancelUploads(VkBuffer buffer) const { mStaging->Cancel(buffer); }
+    /**
+     * @brief Instantly submits commands to the device and waits for them to
+     * complete.
+     *
+     * Can be called from any thread, concurrent calls are executed one after
+     * the other.
      *
      * @param func Function that takes a VkCommandBuffer and records commands
      * into it.
      */
     void SubmitCommand(std::function<void(VkCommandBuffer)> func, bool graphics = true);
+    /**
+     * @brief Locks the queues for a submission or a present.
+     *
+     * Vulkan queues must not be used by several threads at once, so every
+     * vkQueue* call has to be made while holding this lock.
+     */
+    [[nodiscard]] std::unique_lock<std::mutex> LockQueues() const {
+        return std::unique_lock<std::mutex>(mQueueMutex);
+    }
 
 private:
     VkInstance mInstance;
     VkDebugUtilsMessengerEXT mDebugMessenger;
     VkPhysicalDevice mPhysicalDevice;
     VkDevice mDevice;
+    // Destroyed before the device, after every resource allocated from it.
+    std::unique_ptr<MemoryAllocator> mAllocator;
+    std::unique_ptr<StagingRing> mStaging;
 
     VkCommandPool mCommandPool;
     VkCommandBuffer mCommandBuffer;
+    VkFence mCommandFence;
+    // Guards the command pool SubmitCommand records into.
+    std::mutex mCommandMutex;
+    mutable std::mutex mQueueMutex;
 
     Queue mGraphicsQueue;
     Queue mComputeQueue;